@@ -0,0 +1,53 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QTextStream>
+
+#include "asemansettings.h"
+
+// A settings object with one property, like a slider bound to the settings in qml
+class BenchmarkSettings : public AsemanSettings
+{
+    Q_OBJECT
+    Q_PROPERTY(int position READ position WRITE setPosition NOTIFY positionChanged)
+
+public:
+    BenchmarkSettings(QObject *parent = 0): AsemanSettings(parent), _position(0) {}
+
+    void setPosition(int position) {
+        if(_position == position)
+            return;
+        _position = position;
+        Q_EMIT positionChanged();
+    }
+    int position() const { return _position; }
+
+Q_SIGNALS:
+    void positionChanged();
+
+private:
+    int _position;
+};
+
+void calendarBenchmark(QTextStream &out, int count);
+void settingsBenchmark(QTextStream &out, int count, int writeDelay);
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,20 @@
+# Benchmarks of the library, built against the lib/ of the same build tree:
+#   qmake asemantools.pro && make, then qmake demos/benchmarks && make
+TEMPLATE = app
+TARGET = asemantools-benchmarks
+QT = core
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+DEFINES += QT_MESSAGELOGCONTEXT
+
+LIBS += -L$$OUT_PWD/../../lib -lasemantools
+INCLUDEPATH += ../../lib
+
+SOURCES += \
+    main.cpp \
+    calendarbenchmark.cpp \
+    settingsbenchmark.cpp
+
+HEADERS += \
+    benchmarks.h
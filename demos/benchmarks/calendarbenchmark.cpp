@@ -0,0 +1,107 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "benchmarks.h"
+#include "asemancalendarconvertercore.h"
+
+#include <QElapsedTimer>
+#include <QVector>
+
+#define CALENDAR_BENCHMARK_FORMAT "dddd, dd MMMM yyyy - HH:mm:ss"
+
+// paperString() as it was before the formats were compiled, kept as the reference
+QString calendar_benchmark_legacy(AsemanCalendarConverterCore &core, const QDateTime &d, const QString &format)
+{
+    const DateProperty & dp = core.getDate(d.date());
+    QString res = format;
+    res.replace("HH", QString::number(d.time().hour()).rightJustified(2,'0'));
+    res.replace("hh", QString::number(d.time().hour()%12).rightJustified(2,'0'));
+    res.replace("H", QString::number(d.time().hour()));
+    res.replace("h", QString::number(d.time().hour()%12));
+    res.replace("mm", QString::number(d.time().minute()).rightJustified(2,'0'));
+    res.replace("m", QString::number(d.time().minute()));
+    res.replace("ss", QString::number(d.time().second()).rightJustified(2,'0'));
+    res.replace("s", QString::number(d.time().second()));
+    res.replace("yyyy", QString::number(dp.year));
+    res.replace("yy", QString::number(dp.year).right(2));
+    res.replace("dddd", core.dayName(dp.day_of_week));
+    res.replace("MMMM", core.monthName(dp.month));
+    res.replace("dd", QString::number(dp.day).rightJustified(2,'0'));
+    res.replace("MM", QString::number(dp.month).rightJustified(2,'0'));
+    return res;
+}
+
+QString calendar_benchmark_legacy(AsemanCalendarConverterCore &core, const QDateTime &dt)
+{
+    const DateProperty & dp = core.getDate(dt.date());
+    return QString("%1, %2 %3 %4, %5").arg(core.dayName(dp.day_of_week)).arg(dp.day).arg(core.monthName(dp.month)).arg(dp.year).arg(dt.time().toString("hh:mm"));
+}
+
+void calendarBenchmark(QTextStream &out, int count)
+{
+    // About 37 years of timestamps, every 3h17m
+    QVector<QDateTime> times;
+    times.reserve(count);
+    const qint64 start = QDateTime(QDate(2000,1,1), QTime(0,0)).toMSecsSinceEpoch();
+    for(int i=0; i<count; i++)
+        times << QDateTime::fromMSecsSinceEpoch(start + qint64(i)*197*60*1000);
+
+    const QString format = CALENDAR_BENCHMARK_FORMAT;
+    const char *calendarNames[] = {"Gregorian", "Jalali", "Hijri"};
+
+    out << "paperString() over " << count << " timestamps, format \"" << format << "\"" << endl;
+    for(int c=AsemanCalendarConverterCore::Gregorian; c<=AsemanCalendarConverterCore::Hijri; c++)
+    {
+        AsemanCalendarConverterCore core;
+        core.setCalendar(static_cast<AsemanCalendarConverterCore::CalendarTypes>(c));
+
+        qint64 length = 0;
+        int mismatches = 0;
+        QElapsedTimer timer;
+
+        timer.start();
+        for(const QDateTime &dt: times)
+            length += calendar_benchmark_legacy(core, dt, format).size();
+        const qint64 legacyFormat = timer.nsecsElapsed();
+
+        timer.start();
+        for(const QDateTime &dt: times)
+            length += core.paperString(dt, format).size();
+        const qint64 compiledFormat = timer.nsecsElapsed();
+
+        timer.start();
+        for(const QDateTime &dt: times)
+            length += calendar_benchmark_legacy(core, dt).size();
+        const qint64 legacyDefault = timer.nsecsElapsed();
+
+        timer.start();
+        for(const QDateTime &dt: times)
+            length += core.paperString(dt).size();
+        const qint64 compiledDefault = timer.nsecsElapsed();
+
+        for(const QDateTime &dt: times)
+            if(calendar_benchmark_legacy(core, dt, format) != core.paperString(dt, format) ||
+               calendar_benchmark_legacy(core, dt) != core.paperString(dt))
+                mismatches++;
+
+        out << "  " << calendarNames[c] << ":" << endl
+            << "    format   before " << legacyFormat/1000000.0 << " ms, after " << compiledFormat/1000000.0 << " ms" << endl
+            << "    default  before " << legacyDefault/1000000.0 << " ms, after " << compiledDefault/1000000.0 << " ms" << endl
+            << "    different results: " << mismatches << " (" << length << " chars)" << endl;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Prints the timings of the library parts with a before/after comparison:
+ *   asemantools-benchmarks [calendar|settings] [count] [writeDelay]
+ * calendar defaults to 100000 timestamps, settings to 10000 changes and
+ * a writeDelay of 500ms for the write-behind run.
+ */
+
+#include "benchmarks.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    const QStringList &args = app.arguments();
+    const QString &name = args.value(1);
+    const int count = args.value(2).toInt();
+    const int writeDelay = args.value(3, "500").toInt();
+
+    if(name.isEmpty() || name == "calendar")
+        calendarBenchmark(out, count>0? count : 100000);
+    if(name.isEmpty() || name == "settings")
+        settingsBenchmark(out, count>0? count : 10000, writeDelay);
+
+    return 0;
+}
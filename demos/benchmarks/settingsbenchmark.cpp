@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "benchmarks.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QFile>
+
+class SettingsBenchmarkIo
+{
+public:
+    qint64 writeCalls;
+    qint64 writtenBytes;
+};
+
+// Writes of the whole process, so the writer thread is counted too. Only Linux reports them.
+SettingsBenchmarkIo settings_benchmark_io()
+{
+    SettingsBenchmarkIo res;
+    res.writeCalls = -1;
+    res.writtenBytes = -1;
+
+    QFile file("/proc/self/io");
+    if(!file.open(QFile::ReadOnly))
+        return res;
+
+    for(const QByteArray &line: file.readAll().split('\n'))
+    {
+        if(line.startsWith("syscw: "))
+            res.writeCalls = line.mid(7).toLongLong();
+        else
+        if(line.startsWith("wchar: "))
+            res.writtenBytes = line.mid(7).toLongLong();
+    }
+    return res;
+}
+
+void settings_benchmark_run(QTextStream &out, const QString &path, int format, int count, int writeDelay)
+{
+    BenchmarkSettings settings;
+    settings.setFormat(format);
+    settings.setWriteDelay(writeDelay);
+    settings.setSource(path);
+    settings.setCategory("benchmark");
+
+    const SettingsBenchmarkIo &before = settings_benchmark_io();
+    QElapsedTimer timer;
+    timer.start();
+
+    // Every change is a new event loop pass, like the moves of a slider
+    for(int i=1; i<=count; i++)
+    {
+        settings.setPosition(i);
+        QCoreApplication::processEvents();
+    }
+    const qint64 changes = timer.nsecsElapsed();
+
+    // Back to direct writes, it waits for the batches on the way
+    timer.start();
+    settings.setWriteDelay(0);
+    const qint64 flush = timer.nsecsElapsed();
+
+    // The ini file is synced when its QSettings is destroyed
+    timer.start();
+    settings.setSource(QString());
+    const qint64 close = timer.nsecsElapsed();
+
+    const SettingsBenchmarkIo &after = settings_benchmark_io();
+
+    out << "    writeDelay " << writeDelay << ": main thread " << (changes+flush+close)/1000000.0 << " ms"
+        << " (changes " << changes/1000000.0 << " ms, flush " << flush/1000000.0 << " ms, close " << close/1000000.0 << " ms)";
+    if(before.writeCalls >= 0 && after.writeCalls >= 0)
+        out << ", " << after.writeCalls-before.writeCalls << " write calls, "
+            << (after.writtenBytes-before.writtenBytes)/1024 << " KiB written";
+    out << endl;
+
+    // The last change must be on the disk
+    BenchmarkSettings check;
+    check.setFormat(format);
+    check.setSource(path);
+    check.setCategory("benchmark");
+    if(check.position() != count)
+        out << "    error: position " << check.position() << " is read back instead of " << count << endl;
+}
+
+void settingsBenchmark(QTextStream &out, int count, int writeDelay)
+{
+    QTemporaryDir dir;
+    if(!dir.isValid())
+    {
+        out << "Can't create a temporary directory" << endl;
+        return;
+    }
+
+    out << count << " property changes of AsemanSettings" << endl;
+
+    out << "  IniFormat:" << endl;
+    settings_benchmark_run(out, dir.path() + "/before.ini", AsemanSettings::IniFormat, count, 0);
+    settings_benchmark_run(out, dir.path() + "/after.ini", AsemanSettings::IniFormat, count, writeDelay);
+
+    out << "  BinaryFormat:" << endl;
+    settings_benchmark_run(out, dir.path() + "/before-binary.ini", AsemanSettings::BinaryFormat, count, 0);
+    settings_benchmark_run(out, dir.path() + "/after-binary.ini", AsemanSettings::BinaryFormat, count, writeDelay);
+}
@@ -20,12 +20,14 @@
 #include "asemandevices.h"
 #include "asemanjavalayer.h"
 #include "asemantools.h"
+#include "asemanbinarysettings.h"
 #include "qtsingleapplication/qtlocalpeer.h"
 
 #include <QDir>
 #include <QFont>
 #include <QPalette>
 #include <QSettings>
+#include <QFile>
 #include <QThread>
 #include <QCoreApplication>
 #include <QDebug>
@@ -105,6 +107,8 @@
 #endif
 
 static QSettings *app_global_settings = 0;
+static AsemanSettingsBackend *app_global_settings_backend = 0;
+static int app_global_settings_format = AsemanSettingsBackend::IniFormat;
 static AsemanApplication *aseman_app_singleton = 0;
 static QSet<AsemanApplication*> aseman_app_objects;
 static QString *aseman_app_home_path = 0;
@@ -762,6 +766,47 @@ QSettings *AsemanApplication::settings()
     return app_global_settings;
 }
 
+void AsemanApplication::setSettingsFormat(int format)
+{
+    if(app_global_settings_format == format)
+        return;
+
+    app_global_settings_format = format;
+    if(app_global_settings_backend)
+        delete app_global_settings_backend;
+
+    app_global_settings_backend = 0;
+}
+
+int AsemanApplication::settingsFormat()
+{
+    return app_global_settings_format;
+}
+
+AsemanSettingsBackend *AsemanApplication::settingsBackend()
+{
+    if( !app_global_settings_backend )
+    {
+        QDir().mkpath(AsemanApplication::homePath());
+        if( app_global_settings_format == AsemanSettingsBackend::BinaryFormat )
+        {
+            const QString &iniPath = AsemanApplication::homePath() + "/config.ini";
+            const QString &path = AsemanApplication::homePath() + "/config.dat";
+            const bool migrate = !QFile::exists(path) && QFile::exists(iniPath);
+
+            AsemanBinarySettings *settings = new AsemanBinarySettings(path);
+            if(migrate)
+                settings->importIni(iniPath);
+
+            app_global_settings_backend = settings;
+        }
+        else
+            app_global_settings_backend = AsemanSettingsBackend::create(AsemanApplication::homePath() + "/config.ini", app_global_settings_format);
+    }
+
+    return app_global_settings_backend;
+}
+
 void AsemanApplication::refreshTranslations()
 {
     Q_EMIT languageUpdated();
@@ -792,12 +837,15 @@ void AsemanApplication::sleep(quint64 ms)
 
 void AsemanApplication::setSetting(const QString &key, const QVariant &value)
 {
-    settings()->setValue(key, value);
+    AsemanSettingsBackend *backend = settingsBackend();
+    backend->setValue(key, value);
+    if(app_global_settings_format == AsemanSettingsBackend::BinaryFormat)
+        backend->sync();
 }
 
 QVariant AsemanApplication::readSetting(const QString &key, const QVariant &defaultValue)
 {
-    return settings()->value(key, defaultValue);
+    return settingsBackend()->value(key, defaultValue);
 }
 
 bool AsemanApplication::eventFilter(QObject *o, QEvent *e)
@@ -51,6 +51,7 @@
 #endif
 
 class QSettings;
+class AsemanSettingsBackend;
 class AsemanApplicationPrivate;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanApplication : public AsemanQuickObject
 {
@@ -183,6 +184,11 @@ public:
 
     static QSettings *settings();
 
+    // Store of setSetting() and readSetting(). The binary one imports config.ini once.
+    static void setSettingsFormat(int format);
+    static int settingsFormat();
+    static AsemanSettingsBackend *settingsBackend();
+
     inline operator QCoreApplication*() const { return qapp(); }
 
 public Q_SLOTS:
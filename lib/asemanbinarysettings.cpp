@@ -0,0 +1,542 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define BINARY_SETTINGS_MAGIC "ASKV"
+#define BINARY_SETTINGS_MAGIC_SIZE 4
+#define BINARY_SETTINGS_VERSION 1
+#define BINARY_SETTINGS_HEADER_SIZE 8
+#define BINARY_SETTINGS_RECORD_HEAD 9
+#define BINARY_SETTINGS_COMPACT_SIZE 65536
+
+#include "asemanbinarysettings.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QSettings>
+#include <QDataStream>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <QtEndian>
+
+#include <cstring>
+
+/*
+ * File layout:
+ *   "ASKV" | version (quint32 LE) | records ...
+ * Each record:
+ *   type (uchar) | key size (quint32 LE) | value size (quint32 LE) | utf8 key | value
+ * Values are QVariants written by QDataStream. A newer record of a key
+ * overrides the older ones, so writes only append to the file.
+ */
+
+enum AsemanBinarySettingsRecordType {
+    AsemanBinarySettingsSetRecord = 1,
+    AsemanBinarySettingsRemoveRecord = 2
+};
+
+class AsemanBinarySettingsEntry
+{
+public:
+    AsemanBinarySettingsEntry(qint64 record = 0, int keySize = 0, int valueSize = 0): record(record), keySize(keySize), valueSize(valueSize) {}
+    qint64 record;
+    int keySize;
+    int valueSize;
+
+    qint64 size() const { return BINARY_SETTINGS_RECORD_HEAD + keySize + valueSize; }
+};
+
+class AsemanBinarySettingsChange
+{
+public:
+    AsemanBinarySettingsChange(): remove(false) {}
+    QVariant value;
+    bool remove;
+};
+
+void aseman_binary_settings_append(QByteArray &out, int type, const QString &key, const QVariant &value)
+{
+    const QByteArray &keyData = key.toUtf8();
+    QByteArray valueData;
+    if(type == AsemanBinarySettingsSetRecord)
+    {
+        QDataStream stream(&valueData, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << value;
+    }
+
+    uchar head[BINARY_SETTINGS_RECORD_HEAD];
+    head[0] = static_cast<uchar>(type);
+    qToLittleEndian<quint32>(keyData.size(), head+1);
+    qToLittleEndian<quint32>(valueData.size(), head+5);
+
+    out.append(reinterpret_cast<const char*>(head), BINARY_SETTINGS_RECORD_HEAD);
+    out.append(keyData);
+    out.append(valueData);
+}
+
+
+/*
+ * One core per file in the process. All the AsemanBinarySettings objects
+ * of a path share it, from any thread.
+ */
+class AsemanBinarySettingsCore
+{
+public:
+    AsemanBinarySettingsCore(const QString &path): path(path), data(0), size(0), liveSize(0), broken(false) {}
+    ~AsemanBinarySettingsCore()
+    {
+        writeChanges();
+        unload();
+    }
+
+    void load();
+    void unload();
+    bool map();
+    bool writeChanges();
+    bool compact();
+    bool importIni(const QString &iniPath);
+    QVariant read(const AsemanBinarySettingsEntry &entry) const;
+
+    QMutex mutex;
+    QString path;
+    QFile file;
+    const uchar *data;
+    qint64 size;
+    qint64 liveSize;
+    bool broken;
+
+    QHash<QString, AsemanBinarySettingsEntry> index;
+    QHash<QString, AsemanBinarySettingsChange> changes;
+};
+
+void AsemanBinarySettingsCore::load()
+{
+    unload();
+
+    file.setFileName(path);
+    if(!file.exists())
+        return;
+    if(!file.open(QFile::ReadWrite) || !map())
+    {
+        unload();
+        broken = true;
+        return;
+    }
+
+    // An empty file gets its header on the first write, like a new one
+    if(size == 0)
+    {
+        unload();
+        return;
+    }
+
+    // Other files are never written over, see aseman_binary_settings_path()
+    if(size < BINARY_SETTINGS_HEADER_SIZE || memcmp(data, BINARY_SETTINGS_MAGIC, BINARY_SETTINGS_MAGIC_SIZE) != 0 ||
+       qFromLittleEndian<quint32>(data + BINARY_SETTINGS_MAGIC_SIZE) > BINARY_SETTINGS_VERSION)
+    {
+        unload();
+        broken = true;
+        return;
+    }
+
+    qint64 pos = BINARY_SETTINGS_HEADER_SIZE;
+    while(pos + BINARY_SETTINGS_RECORD_HEAD <= size)
+    {
+        const uchar *head = data + pos;
+        const quint32 keySize = qFromLittleEndian<quint32>(head+1);
+        const quint32 valueSize = qFromLittleEndian<quint32>(head+5);
+        const qint64 recordSize = qint64(BINARY_SETTINGS_RECORD_HEAD) + keySize + valueSize;
+        if(pos + recordSize > size)
+            break;
+
+        const QString &key = QString::fromUtf8(reinterpret_cast<const char*>(head + BINARY_SETTINGS_RECORD_HEAD), keySize);
+        QHash<QString, AsemanBinarySettingsEntry>::iterator i = index.find(key);
+        if(i != index.end())
+        {
+            liveSize -= i->size();
+            index.erase(i);
+        }
+
+        if(head[0] == AsemanBinarySettingsSetRecord)
+        {
+            index.insert(key, AsemanBinarySettingsEntry(pos, keySize, valueSize));
+            liveSize += recordSize;
+        }
+
+        pos += recordSize;
+    }
+
+    // A record cut by a crash is dropped, and overwritten by the next write
+    size = pos;
+}
+
+void AsemanBinarySettingsCore::unload()
+{
+    if(data)
+        file.unmap(const_cast<uchar*>(data));
+    if(file.isOpen())
+        file.close();
+
+    data = 0;
+    size = 0;
+    liveSize = 0;
+    broken = false;
+    index.clear();
+}
+
+bool AsemanBinarySettingsCore::map()
+{
+    if(data)
+        file.unmap(const_cast<uchar*>(data));
+
+    data = 0;
+    size = file.size();
+    if(size == 0)
+        return true;
+
+    data = file.map(0, size);
+    return data != 0;
+}
+
+bool AsemanBinarySettingsCore::writeChanges()
+{
+    if(changes.isEmpty())
+        return true;
+    if(broken)
+        return false;
+    if(!file.isOpen())
+        return compact();
+
+    QByteArray log;
+    QList< QPair<QString, AsemanBinarySettingsEntry> > entries;
+    QHashIterator<QString, AsemanBinarySettingsChange> i(changes);
+    while(i.hasNext())
+    {
+        i.next();
+        const int start = log.size();
+        aseman_binary_settings_append(log, i.value().remove? AsemanBinarySettingsRemoveRecord : AsemanBinarySettingsSetRecord, i.key(), i.value().value);
+
+        const uchar *head = reinterpret_cast<const uchar*>(log.constData() + start);
+        entries << QPair<QString, AsemanBinarySettingsEntry>(i.key(), AsemanBinarySettingsEntry(i.value().remove? -1 : size + start,
+                                                                                                  qFromLittleEndian<quint32>(head+1),
+                                                                                                  qFromLittleEndian<quint32>(head+5)));
+    }
+
+    // The file grows, so the old view is dropped before writing
+    const qint64 validSize = size;
+    if(data)
+        file.unmap(const_cast<uchar*>(data));
+    data = 0;
+
+    bool done = (file.size() == validSize || file.resize(validSize)) && file.seek(validSize) &&
+                file.write(log) == log.size() && file.flush();
+    if(!map() || !done)
+    {
+        // Nothing is applied, the changes stay pending for the next try
+        file.resize(validSize);
+        map();
+        size = validSize;
+        return false;
+    }
+
+    for(const QPair<QString, AsemanBinarySettingsEntry> &entry: entries)
+    {
+        QHash<QString, AsemanBinarySettingsEntry>::iterator j = index.find(entry.first);
+        if(j != index.end())
+        {
+            liveSize -= j->size();
+            index.erase(j);
+        }
+        if(entry.second.record < 0)
+            continue;
+
+        index.insert(entry.first, entry.second);
+        liveSize += entry.second.size();
+    }
+    changes.clear();
+
+    const qint64 deadSize = size - BINARY_SETTINGS_HEADER_SIZE - liveSize;
+    if(size > BINARY_SETTINGS_COMPACT_SIZE && deadSize > liveSize)
+        compact();
+
+    return true;
+}
+
+bool AsemanBinarySettingsCore::compact()
+{
+    if(broken)
+        return false;
+
+    uchar header[BINARY_SETTINGS_HEADER_SIZE];
+    memcpy(header, BINARY_SETTINGS_MAGIC, BINARY_SETTINGS_MAGIC_SIZE);
+    qToLittleEndian<quint32>(BINARY_SETTINGS_VERSION, header + BINARY_SETTINGS_MAGIC_SIZE);
+
+    QByteArray content;
+    content.reserve(static_cast<int>(BINARY_SETTINGS_HEADER_SIZE + liveSize));
+    content.append(reinterpret_cast<const char*>(header), BINARY_SETTINGS_HEADER_SIZE);
+
+    // Live records are copied as they are, only the changes are encoded
+    QHashIterator<QString, AsemanBinarySettingsEntry> i(index);
+    while(i.hasNext())
+    {
+        i.next();
+        if(changes.contains(i.key()))
+            continue;
+
+        content.append(reinterpret_cast<const char*>(data + i.value().record), static_cast<int>(i.value().size()));
+    }
+
+    QHashIterator<QString, AsemanBinarySettingsChange> j(changes);
+    while(j.hasNext())
+    {
+        j.next();
+        if(!j.value().remove)
+            aseman_binary_settings_append(content, AsemanBinarySettingsSetRecord, j.key(), j.value().value);
+    }
+
+    QSaveFile out(path);
+    if(!out.open(QFile::WriteOnly) || out.write(content) != content.size())
+        return false;
+
+    // The old file can't be replaced while it's mapped on some platforms
+    unload();
+    if(!out.commit())
+    {
+        load();
+        return false;
+    }
+
+    changes.clear();
+    load();
+    return true;
+}
+
+bool AsemanBinarySettingsCore::importIni(const QString &iniPath)
+{
+    QSettings ini(iniPath, QSettings::IniFormat);
+    if(ini.status() != QSettings::NoError)
+        return false;
+
+    for(const QString &key: ini.allKeys())
+    {
+        AsemanBinarySettingsChange &change = changes[key];
+        change.value = ini.value(key);
+        change.remove = false;
+    }
+
+    return true;
+}
+
+QVariant AsemanBinarySettingsCore::read(const AsemanBinarySettingsEntry &entry) const
+{
+    const char *value = reinterpret_cast<const char*>(data + entry.record + BINARY_SETTINGS_RECORD_HEAD + entry.keySize);
+    QDataStream stream(QByteArray::fromRawData(value, entry.valueSize));
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    QVariant result;
+    stream >> result;
+    return result;
+}
+
+
+/*
+ * The store is always the ".dat" file next to the path, whatever is on the
+ * disk, so the INI readers of the path never see binary data. An INI file
+ * on the path is imported once, when the store is created.
+ */
+QString aseman_binary_settings_path(const QString &path, QString *iniPath)
+{
+    const QFileInfo info(path);
+    if(info.suffix() == "dat")
+        return path;
+
+    const QString &base = info.completeBaseName().isEmpty()? info.fileName() : info.completeBaseName();
+    if(info.exists())
+        *iniPath = path;
+
+    return info.dir().filePath(base + ".dat");
+}
+
+bool aseman_binary_settings_is_store(const QString &path)
+{
+    QFile file(path);
+    return file.open(QFile::ReadOnly) && file.read(BINARY_SETTINGS_MAGIC_SIZE) == QByteArray(BINARY_SETTINGS_MAGIC, BINARY_SETTINGS_MAGIC_SIZE);
+}
+
+
+/*
+ * Cores are created and released only with the mutex held, so the last
+ * write of a released core ends before the next one of its path loads it.
+ */
+class AsemanBinarySettingsRegistry
+{
+public:
+    QMutex mutex;
+    QHash<QString, QWeakPointer<AsemanBinarySettingsCore> > cores;
+};
+
+Q_GLOBAL_STATIC(AsemanBinarySettingsRegistry, aseman_binary_settings_registry)
+
+class AsemanBinarySettingsPrivate
+{
+public:
+    QSharedPointer<AsemanBinarySettingsCore> core;
+};
+
+AsemanBinarySettings::AsemanBinarySettings(const QString &path)
+{
+    p = new AsemanBinarySettingsPrivate;
+
+    AsemanBinarySettingsRegistry *registry = aseman_binary_settings_registry();
+    QMutexLocker locker(&registry->mutex);
+
+    QString iniPath;
+    const QString &absolutePath = aseman_binary_settings_path(QFileInfo(path).absoluteFilePath(), &iniPath);
+    p->core = registry->cores.value(absolutePath).toStrongRef();
+    if(p->core)
+        return;
+
+    p->core = QSharedPointer<AsemanBinarySettingsCore>(new AsemanBinarySettingsCore(absolutePath));
+    bool migrate = !iniPath.isEmpty() && !QFile::exists(absolutePath);
+
+    // Older versions kept a new store on the path itself, it's moved to its place
+    if(migrate && aseman_binary_settings_is_store(iniPath))
+    {
+        QFile::rename(iniPath, absolutePath);
+        migrate = false;
+    }
+
+    p->core->load();
+    if(migrate && p->core->importIni(iniPath))
+        p->core->writeChanges();
+
+    registry->cores[absolutePath] = p->core;
+}
+
+QString AsemanBinarySettings::fileName() const
+{
+    return p->core->path;
+}
+
+QVariant AsemanBinarySettings::value(const QString &key, const QVariant &defaultValue) const
+{
+    QMutexLocker locker(&p->core->mutex);
+    QHash<QString, AsemanBinarySettingsChange>::const_iterator i = p->core->changes.constFind(key);
+    if(i != p->core->changes.constEnd())
+        return i->remove? defaultValue : i->value;
+
+    QHash<QString, AsemanBinarySettingsEntry>::const_iterator j = p->core->index.constFind(key);
+    if(j == p->core->index.constEnd())
+        return defaultValue;
+
+    return p->core->read(*j);
+}
+
+void AsemanBinarySettings::setValue(const QString &key, const QVariant &value)
+{
+    QMutexLocker locker(&p->core->mutex);
+    AsemanBinarySettingsChange &change = p->core->changes[key];
+    change.value = value;
+    change.remove = false;
+}
+
+void AsemanBinarySettings::remove(const QString &key)
+{
+    QMutexLocker locker(&p->core->mutex);
+    AsemanBinarySettingsChange &change = p->core->changes[key];
+    change.value = QVariant();
+    change.remove = true;
+}
+
+bool AsemanBinarySettings::contains(const QString &key) const
+{
+    QMutexLocker locker(&p->core->mutex);
+    QHash<QString, AsemanBinarySettingsChange>::const_iterator i = p->core->changes.constFind(key);
+    if(i != p->core->changes.constEnd())
+        return !i->remove;
+
+    return p->core->index.contains(key);
+}
+
+QStringList AsemanBinarySettings::childKeys(const QString &group) const
+{
+    const QString &prefix = group.isEmpty()? QString() : group + "/";
+    QStringList result;
+
+    QMutexLocker locker(&p->core->mutex);
+    QHashIterator<QString, AsemanBinarySettingsEntry> i(p->core->index);
+    while(i.hasNext())
+    {
+        i.next();
+        if(!i.key().startsWith(prefix) || p->core->changes.contains(i.key()))
+            continue;
+
+        const QString &key = i.key().mid(prefix.length());
+        if(!key.contains("/"))
+            result << key;
+    }
+
+    QHashIterator<QString, AsemanBinarySettingsChange> j(p->core->changes);
+    while(j.hasNext())
+    {
+        j.next();
+        if(j.value().remove || !j.key().startsWith(prefix))
+            continue;
+
+        const QString &key = j.key().mid(prefix.length());
+        if(!key.contains("/"))
+            result << key;
+    }
+
+    return result;
+}
+
+void AsemanBinarySettings::sync()
+{
+    QMutexLocker locker(&p->core->mutex);
+    p->core->writeChanges();
+}
+
+bool AsemanBinarySettings::compact()
+{
+    QMutexLocker locker(&p->core->mutex);
+    return p->core->compact();
+}
+
+bool AsemanBinarySettings::importIni(const QString &path)
+{
+    QMutexLocker locker(&p->core->mutex);
+    return p->core->importIni(path) && p->core->writeChanges();
+}
+
+AsemanBinarySettings::~AsemanBinarySettings()
+{
+    AsemanBinarySettingsRegistry *registry = aseman_binary_settings_registry();
+    QMutexLocker locker(&registry->mutex);
+
+    const QString path = p->core->path;
+    p->core.clear();
+    if(registry->cores.value(path).isNull())
+        registry->cores.remove(path);
+
+    delete p;
+}
@@ -0,0 +1,50 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANBINARYSETTINGS_H
+#define ASEMANBINARYSETTINGS_H
+
+#include "asemansettingsbackend.h"
+
+class AsemanBinarySettingsPrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanBinarySettings : public AsemanSettingsBackend
+{
+public:
+    // The store is the ".dat" file next to the path, an INI file on the path is imported once
+    AsemanBinarySettings(const QString &path);
+    virtual ~AsemanBinarySettings();
+
+    QString fileName() const;
+
+    QVariant value(const QString &key, const QVariant &defaultValue = QVariant()) const;
+    void setValue(const QString &key, const QVariant &value);
+    void remove(const QString &key);
+    bool contains(const QString &key) const;
+    QStringList childKeys(const QString &group = QString()) const;
+
+    // Appends the changes to the file. Rewrites it when mostly overwritten records remain.
+    void sync();
+    bool compact();
+
+    bool importIni(const QString &path);
+
+private:
+    AsemanBinarySettingsPrivate *p;
+};
+
+#endif // ASEMANBINARYSETTINGS_H
@@ -16,35 +16,293 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define CALENDAR_MEMO_SIZE 256
+#define CALENDAR_FORMAT_CACHE_SIZE 64
+
 #include "asemancalendarconvertercore.h"
 
 #include <QObject>
+#include <QCache>
+#include <QVector>
+
+#include <limits>
+
+static constexpr int aseman_gregorian_months_start[13]      = {0,31,59,90,120,151,181,212,243,273,304,334,365};
+static constexpr int aseman_gregorian_leap_months_start[13] = {0,31,60,91,121,152,182,213,244,274,305,335,366};
+
+static constexpr int aseman_jalali_months_start[13]      = {0,31,62,93,124,155,186,216,246,276,306,336,365};
+static constexpr int aseman_jalali_leap_months_start[13] = {0,31,62,93,124,155,186,216,246,276,306,336,366};
+
+static constexpr int aseman_hijri_months_start[13]      = {0,30,59,89,118,148,177,207,236,266,295,325,354};
+static constexpr int aseman_hijri_leap_months_start[13] = {0,30,59,89,118,148,177,207,236,266,295,325,355};
+static constexpr int aseman_hijri_leap_years[11]        = {2,5,7,10,13,16,18,21,24,26,29};
+
+// index in aseman_hijri_leap_years of each year of the 30 years cycle, or -1
+static constexpr qint8 aseman_hijri_leap_index[30] = {-1,-1,0,-1,-1,1,-1,2,-1,-1,3,-1,-1,4,-1,-1,5,-1,6,-1,-1,7,-1,-1,8,-1,9,-1,-1,10};
+
+/*
+ * Months are 28 to 31 days long, so day/32 is at most two months short
+ * of the month containing the zero based day of the year.
+ */
+static inline int aseman_month_of_day( const int *months_start, int day )
+{
+    int month = qMin( day>>5, 11 );
+    while( month<11 && months_start[month+1]<=day )
+        month++;
+
+    return month;
+}
+
+enum AsemanCalendarFormatTokenType {
+    AsemanCalendarFormatText,
+    AsemanCalendarFormatHour24Padded,
+    AsemanCalendarFormatHour12Padded,
+    AsemanCalendarFormatHour24,
+    AsemanCalendarFormatHour12,
+    AsemanCalendarFormatMinutePadded,
+    AsemanCalendarFormatMinute,
+    AsemanCalendarFormatSecondPadded,
+    AsemanCalendarFormatSecond,
+    AsemanCalendarFormatYear,
+    AsemanCalendarFormatYearShort,
+    AsemanCalendarFormatDayName,
+    AsemanCalendarFormatMonthName,
+    AsemanCalendarFormatDayPadded,
+    AsemanCalendarFormatMonthPadded,
+    // not in format strings, only used by the fixed formats
+    AsemanCalendarFormatDay,
+    AsemanCalendarFormatMonth
+};
+
+class AsemanCalendarFormatToken
+{
+public:
+    AsemanCalendarFormatToken(int type = AsemanCalendarFormatText, const QString &text = QString()): type(type), text(text) {}
+    int type;
+    QString text;
+};
+
+typedef QVector<AsemanCalendarFormatToken> AsemanCalendarFormat;
+
+// Longer patterns first, so "yyyy" is never read as two "yy"
+static const struct {
+    const char *pattern;
+    int type;
+} aseman_calendar_format_patterns[] = {
+    {"yyyy", AsemanCalendarFormatYear},
+    {"dddd", AsemanCalendarFormatDayName},
+    {"MMMM", AsemanCalendarFormatMonthName},
+    {"HH", AsemanCalendarFormatHour24Padded},
+    {"hh", AsemanCalendarFormatHour12Padded},
+    {"mm", AsemanCalendarFormatMinutePadded},
+    {"ss", AsemanCalendarFormatSecondPadded},
+    {"yy", AsemanCalendarFormatYearShort},
+    {"dd", AsemanCalendarFormatDayPadded},
+    {"MM", AsemanCalendarFormatMonthPadded},
+    {"H", AsemanCalendarFormatHour24},
+    {"h", AsemanCalendarFormatHour12},
+    {"m", AsemanCalendarFormatMinute},
+    {"s", AsemanCalendarFormatSecond}
+};
+
+AsemanCalendarFormat aseman_calendar_format_compile(const QString &format)
+{
+    const int patternsCount = sizeof(aseman_calendar_format_patterns)/sizeof(aseman_calendar_format_patterns[0]);
 
-int aseman_gregorian_months_start[13]      = {0,31,59,90,120,151,181,212,243,273,304,334,365};
-int aseman_gregorian_leap_months_start[13] = {0,31,60,91,121,152,182,213,244,274,305,335,366};
+    AsemanCalendarFormat res;
+    QString text;
+    for(int i=0; i<format.length(); )
+    {
+        int matched = -1;
+        for(int j=0; j<patternsCount && matched == -1; j++)
+            if(format.midRef(i).startsWith(QLatin1String(aseman_calendar_format_patterns[j].pattern)))
+                matched = j;
 
-int aseman_jalali_months_start[13]      = {0,31,62,93,124,155,186,216,246,276,306,336,365};
-int aseman_jalali_leap_months_start[13] = {0,31,62,93,124,155,186,216,246,276,306,336,366};
+        if(matched == -1)
+        {
+            text += format.at(i);
+            i++;
+            continue;
+        }
+
+        if(!text.isEmpty())
+            res << AsemanCalendarFormatToken(AsemanCalendarFormatText, text);
+        text.clear();
+
+        res << AsemanCalendarFormatToken(aseman_calendar_format_patterns[matched].type);
+        i += static_cast<int>(qstrlen(aseman_calendar_format_patterns[matched].pattern));
+    }
+
+    if(!text.isEmpty())
+        res << AsemanCalendarFormatToken(AsemanCalendarFormatText, text);
+
+    return res;
+}
+
+// Same output as QString::number(n).rightJustified(width,'0'), or .right(2) with lastTwo
+void aseman_calendar_append_number(QString &res, qint64 n, int width = 0, bool lastTwo = false)
+{
+    char buffer[24];
+    int pos = sizeof(buffer);
+    quint64 v = n<0? 0-static_cast<quint64>(n) : static_cast<quint64>(n);
+    do {
+        buffer[--pos] = static_cast<char>('0' + v%10);
+        v /= 10;
+    } while(v);
+    if(n < 0)
+        buffer[--pos] = '-';
+
+    int len = static_cast<int>(sizeof(buffer)) - pos;
+    if(lastTwo && len > 2)
+    {
+        pos += len-2;
+        len = 2;
+    }
+
+    for(int i=len; i<width; i++)
+        res += QLatin1Char('0');
+    res += QLatin1String(buffer+pos, len);
+}
+
+QString aseman_calendar_format_render(AsemanCalendarConverterCore *core, const AsemanCalendarFormat &format, const DateProperty &dp, const QTime &time)
+{
+    QString res;
+    res.reserve(format.count()*12);
+    for(const AsemanCalendarFormatToken &token: format)
+    {
+        switch(token.type)
+        {
+        case AsemanCalendarFormatText:
+            res += token.text;
+            break;
+        case AsemanCalendarFormatHour24Padded:
+            aseman_calendar_append_number(res, time.hour(), 2);
+            break;
+        case AsemanCalendarFormatHour12Padded:
+            aseman_calendar_append_number(res, time.hour()%12, 2);
+            break;
+        case AsemanCalendarFormatHour24:
+            aseman_calendar_append_number(res, time.hour());
+            break;
+        case AsemanCalendarFormatHour12:
+            aseman_calendar_append_number(res, time.hour()%12);
+            break;
+        case AsemanCalendarFormatMinutePadded:
+            aseman_calendar_append_number(res, time.minute(), 2);
+            break;
+        case AsemanCalendarFormatMinute:
+            aseman_calendar_append_number(res, time.minute());
+            break;
+        case AsemanCalendarFormatSecondPadded:
+            aseman_calendar_append_number(res, time.second(), 2);
+            break;
+        case AsemanCalendarFormatSecond:
+            aseman_calendar_append_number(res, time.second());
+            break;
+        case AsemanCalendarFormatYear:
+            aseman_calendar_append_number(res, dp.year);
+            break;
+        case AsemanCalendarFormatYearShort:
+            aseman_calendar_append_number(res, dp.year, 0, true);
+            break;
+        case AsemanCalendarFormatDayName:
+            res += core->dayName(dp.day_of_week);
+            break;
+        case AsemanCalendarFormatMonthName:
+            res += core->monthName(dp.month);
+            break;
+        case AsemanCalendarFormatDayPadded:
+            aseman_calendar_append_number(res, dp.day, 2);
+            break;
+        case AsemanCalendarFormatMonthPadded:
+            aseman_calendar_append_number(res, dp.month, 2);
+            break;
+        case AsemanCalendarFormatDay:
+            aseman_calendar_append_number(res, dp.day);
+            break;
+        case AsemanCalendarFormatMonth:
+            aseman_calendar_append_number(res, dp.month);
+            break;
+        }
+    }
 
-int aseman_hijri_months_start[13]      = {0,30,59,89,118,148,177,207,236,266,295,325,354};
-int aseman_hijri_leap_months_start[13] = {0,30,59,89,118,148,177,207,236,266,295,325,355};
-int aseman_hijri_leap_years[11]        = {2,5,7,10,13,16,18,21,24,26,29};
+    return res;
+}
 
 class AsemanCalendarConverterCorePrivate
 {
 public:
     AsemanCalendarConverterCore::CalendarTypes calendar;
+
+    QCache<QString, AsemanCalendarFormat> formats;
+    AsemanCalendarFormat paperFormat;
+    AsemanCalendarFormat paperDateFormat;
+    AsemanCalendarFormat littleFormat;
+    AsemanCalendarFormat historyFormat;
+    AsemanCalendarFormat numberFormat;
+
+    // direct mapped by julian day, visible dates mostly hit it
+    qint64 memoDay[CALENDAR_MEMO_SIZE];
+    DateProperty memo[CALENDAR_MEMO_SIZE];
+
+    void clearMemo() {
+        for( int i=0 ; i<CALENDAR_MEMO_SIZE ; i++ )
+            memoDay[i] = std::numeric_limits<qint64>::min();
+    }
 };
 
 AsemanCalendarConverterCore::AsemanCalendarConverterCore()
 {
     p = new AsemanCalendarConverterCorePrivate;
     p->calendar = AsemanCalendarConverterCore::Gregorian;
+    p->clearMemo();
+    p->formats.setMaxCost(CALENDAR_FORMAT_CACHE_SIZE);
+
+    p->paperFormat << AsemanCalendarFormatToken(AsemanCalendarFormatDayName)
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatText, ", ")
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatDay)
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatMonthName)
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatYear)
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatText, ", ");
+
+    // An invalid time was written as an empty "hh:mm"
+    p->paperDateFormat = p->paperFormat;
+    p->paperFormat << AsemanCalendarFormatToken(AsemanCalendarFormatHour24Padded)
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatText, ":")
+                   << AsemanCalendarFormatToken(AsemanCalendarFormatMinutePadded);
+
+    p->littleFormat << AsemanCalendarFormatToken(AsemanCalendarFormatDay)
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatMonthName)
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatYear);
+
+    p->historyFormat << AsemanCalendarFormatToken(AsemanCalendarFormatYear)
+                     << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                     << AsemanCalendarFormatToken(AsemanCalendarFormatMonthName)
+                     << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                     << AsemanCalendarFormatToken(AsemanCalendarFormatDay)
+                     << AsemanCalendarFormatToken(AsemanCalendarFormatText, " - ")
+                     << AsemanCalendarFormatToken(AsemanCalendarFormatDayName);
+
+    p->numberFormat << AsemanCalendarFormatToken(AsemanCalendarFormatYear)
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatMonth)
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatText, " ")
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatDay)
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatText, " - ")
+                    << AsemanCalendarFormatToken(AsemanCalendarFormatDayName);
 }
 
 void AsemanCalendarConverterCore::setCalendar(AsemanCalendarConverterCore::CalendarTypes t)
 {
+    if( p->calendar == t )
+        return;
+
     p->calendar = t;
+    p->clearMemo();
 }
 
 AsemanCalendarConverterCore::CalendarTypes AsemanCalendarConverterCore::calendar() const
@@ -54,55 +312,83 @@ AsemanCalendarConverterCore::CalendarTypes AsemanCalendarConverterCore::calendar
 
 QString AsemanCalendarConverterCore::paperString(const QDateTime &dt)
 {
-    const DateProperty & dp = getDate(dt.date());
-    QString res = QString("%1, %2 %3 %4, %5").arg(dayName(dp.day_of_week)).arg(dp.day).arg(monthName(dp.month)).arg(dp.year).arg(dt.time().toString("hh:mm"));
-    return res;
+    const QTime &time = dt.time();
+    return aseman_calendar_format_render(this, time.isValid()? p->paperFormat : p->paperDateFormat, getDate(dt.date()), time);
 }
 
 QString AsemanCalendarConverterCore::paperString(const QDateTime &d, const QString &format)
 {
-    const DateProperty & dp = getDate(d.date());
-    QString res = format;
-    res.replace("HH", QString::number(d.time().hour()).rightJustified(2,'0'));
-    res.replace("hh", QString::number(d.time().hour()%12).rightJustified(2,'0'));
-    res.replace("H", QString::number(d.time().hour()));
-    res.replace("h", QString::number(d.time().hour()%12));
-    res.replace("mm", QString::number(d.time().minute()).rightJustified(2,'0'));
-    res.replace("m", QString::number(d.time().minute()));
-    res.replace("ss", QString::number(d.time().second()).rightJustified(2,'0'));
-    res.replace("s", QString::number(d.time().second()));
-    res.replace("yyyy", QString::number(dp.year));
-    res.replace("yy", QString::number(dp.year).right(2));
-    res.replace("dddd", dayName(dp.day_of_week));
-    res.replace("MMMM", monthName(dp.month));
-    res.replace("dd", QString::number(dp.day).rightJustified(2,'0'));
-    res.replace("MM", QString::number(dp.month).rightJustified(2,'0'));
+    // Formats are tokenized once, so substitutions are never scanned again
+    AsemanCalendarFormat *compiled = p->formats.object(format);
+    if(!compiled)
+    {
+        compiled = new AsemanCalendarFormat(aseman_calendar_format_compile(format));
+        p->formats.insert(format, compiled);
+    }
 
-    return res;
+    return aseman_calendar_format_render(this, *compiled, getDate(d.date()), d.time());
 }
 
 QString AsemanCalendarConverterCore::littleString(const QDate &d)
 {
-    const DateProperty & dp = getDate(d);
-    QString res = QString("%1 %2 %3").arg(dp.day).arg(monthName(dp.month)).arg(dp.year);
-    return res;
+    return aseman_calendar_format_render(this, p->littleFormat, getDate(d), QTime());
 }
 
 QString AsemanCalendarConverterCore::historyString(const QDate &d)
 {
-    const DateProperty & dp = getDate(d);
-    QString res = QString("%1 %2 %3 - %4").arg(dp.year).arg(monthName(dp.month)).arg(dp.day).arg(dayName(dp.day_of_week));
-    return res;
+    return aseman_calendar_format_render(this, p->historyFormat, getDate(d), QTime());
 }
 
 QString AsemanCalendarConverterCore::numberString(const QDate &d)
 {
-    const DateProperty & dp = getDate(d);
-    QString res = QString("%1 %2 %3 - %4").arg(dp.year).arg(dp.month).arg(dp.day).arg(dayName(dp.day_of_week));
-    return res;
+    return aseman_calendar_format_render(this, p->numberFormat, getDate(d), QTime());
 }
 
 DateProperty AsemanCalendarConverterCore::getDate(const QDate &d)
+{
+    if( !d.isValid() )
+        return convertDate(d);
+
+    const qint64 jd = d.toJulianDay();
+    const int slot = static_cast<int>( jd & (CALENDAR_MEMO_SIZE-1) );
+    if( p->memoDay[slot] == jd )
+        return p->memo[slot];
+
+    const DateProperty & res = convertDate(d);
+    p->memoDay[slot] = jd;
+    p->memo[slot] = res;
+    return res;
+}
+
+void AsemanCalendarConverterCore::getDates(const QDate *dates, int count, DateProperty *result)
+{
+    for( int i=0 ; i<count ; i++ )
+        result[i] = getDate(dates[i]);
+}
+
+void AsemanCalendarConverterCore::getDates(const qint64 *msecsSinceEpoch, int count, DateProperty *result)
+{
+    // The local day is looked up once for each run of times inside it
+    qint64 dayStart = 0;
+    qint64 dayEnd = 0;
+    QDate day;
+    for( int i=0 ; i<count ; i++ )
+    {
+        const qint64 t = msecsSinceEpoch[i];
+        if( t < dayStart || t >= dayEnd )
+        {
+            day = QDateTime::fromMSecsSinceEpoch(t).date();
+            dayStart = QDateTime(day, QTime(0,0)).toMSecsSinceEpoch();
+            dayEnd = QDateTime(day.addDays(1), QTime(0,0)).toMSecsSinceEpoch();
+            if( t < dayStart || t >= dayEnd )
+                dayStart = dayEnd = 0;
+        }
+
+        result[i] = getDate(day);
+    }
+}
+
+DateProperty AsemanCalendarConverterCore::convertDate(const QDate &d)
 {
     DateProperty res;
     switch( static_cast<int>(p->calendar) )
@@ -231,77 +517,43 @@ bool AsemanCalendarConverterCore::isLeapGregorian( qint64 year )
 
 QString AsemanCalendarConverterCore::monthNamesGregorian(int m)
 {
-    switch( m )
-    {
-    case 1:
-        return "January";
-        break;
-    case 2:
-        return "February";
-        break;
-    case 3:
-        return "March";
-        break;
-    case 4:
-        return "April";
-        break;
-    case 5:
-        return "May";
-        break;
-    case 6:
-        return "June";
-        break;
-    case 7:
-        return "July";
-        break;
-    case 8:
-        return "August";
-        break;
-    case 9:
-        return "September";
-        break;
-    case 10:
-        return "October";
-        break;
-    case 11:
-        return "November";
-        break;
-    case 12:
-        return "December";
-        break;
-    }
+    static const QString names[12] = {
+        QStringLiteral("January"),
+        QStringLiteral("February"),
+        QStringLiteral("March"),
+        QStringLiteral("April"),
+        QStringLiteral("May"),
+        QStringLiteral("June"),
+        QStringLiteral("July"),
+        QStringLiteral("August"),
+        QStringLiteral("September"),
+        QStringLiteral("October"),
+        QStringLiteral("November"),
+        QStringLiteral("December")
+    };
+
+    if( m<1 || m>12 )
+        return QString();
 
-    return QString();
+    return names[m-1];
 }
 
 QString AsemanCalendarConverterCore::dayNameGregorian(int d)
 {
-    switch( d )
-    {
-    case 1:
-        return "Sunday";
-        break;
-    case 2:
-        return "Monday";
-        break;
-    case 3:
-        return "Tuesday";
-        break;
-    case 4:
-        return "Wednesday";
-        break;
-    case 5:
-        return "Thuresday";
-        break;
-    case 6:
-        return "Friday";
-        break;
-    case 7:
-        return "Saturday";
-        break;
-    }
+    static const QString names[7] = {
+        QStringLiteral("Sunday"),
+        QStringLiteral("Monday"),
+        QStringLiteral("Tuesday"),
+        QStringLiteral("Wednesday"),
+        QStringLiteral("Thuresday"),
+        QStringLiteral("Friday"),
+        QStringLiteral("Saturday")
+    };
+
+    if( d<1 || d>7 )
+        return QString();
 
-    return QString();
+    return names[d-1];
 }
 
 qint64 AsemanCalendarConverterCore::fromDateGregorian( qint64 year , int month , int day )
@@ -375,16 +627,9 @@ DateProperty AsemanCalendarConverterCore::toDateGregorian( qint64 days_from_greg
     day++;
 
     bool leap = isLeapGregorian(year);
-    for( int i=11 ; i>=0 ; i-- )
-    {
-        qint16 month_day = (leap)? aseman_gregorian_leap_months_start[i] : aseman_gregorian_months_start[i] ;
-        if( day > month_day )
-        {
-            month = i;
-            day  -= month_day;
-            break;
-        }
-    }
+    const int *months_start = (leap)? aseman_gregorian_leap_months_start : aseman_gregorian_months_start;
+    month = aseman_month_of_day( months_start, day-1 );
+    day  -= months_start[month];
 
     month++;
 
@@ -408,77 +653,43 @@ bool AsemanCalendarConverterCore::isLeapJalali( qint64 year )
 
 QString AsemanCalendarConverterCore::monthNamesJalali(int m)
 {
-    switch( m )
-    {
-    case 1:
-        return JalaliCalendarObject::tr("Farvardin");
-        break;
-    case 2:
-        return JalaliCalendarObject::tr("Ordibehesht");
-        break;
-    case 3:
-        return JalaliCalendarObject::tr("Khordad");
-        break;
-    case 4:
-        return JalaliCalendarObject::tr("Tir");
-        break;
-    case 5:
-        return JalaliCalendarObject::tr("Mordad");
-        break;
-    case 6:
-        return JalaliCalendarObject::tr("Shahrivar");
-        break;
-    case 7:
-        return JalaliCalendarObject::tr("Mehr");
-        break;
-    case 8:
-        return JalaliCalendarObject::tr("Abaan");
-        break;
-    case 9:
-        return JalaliCalendarObject::tr("Aazar");
-        break;
-    case 10:
-        return JalaliCalendarObject::tr("Dey");
-        break;
-    case 11:
-        return JalaliCalendarObject::tr("Bahman");
-        break;
-    case 12:
-        return JalaliCalendarObject::tr("Esfand");
-        break;
-    }
+    static const char *names[12] = {
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Farvardin"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Ordibehesht"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Khordad"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Tir"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Mordad"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Shahrivar"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Mehr"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Abaan"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Aazar"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Dey"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Bahman"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Esfand")
+    };
 
-    return QString();
+    if( m<1 || m>12 )
+        return QString();
+
+    return JalaliCalendarObject::tr(names[m-1]);
 }
 
 QString AsemanCalendarConverterCore::dayNameJalali(int d)
 {
-    switch( d )
-    {
-    case 1:
-        return JalaliCalendarObject::tr("Shanbe");
-        break;
-    case 2:
-        return JalaliCalendarObject::tr("1Shanbe");
-        break;
-    case 3:
-        return JalaliCalendarObject::tr("2Shanbe");
-        break;
-    case 4:
-        return JalaliCalendarObject::tr("3Shanbe");
-        break;
-    case 5:
-        return JalaliCalendarObject::tr("4Shanbe");
-        break;
-    case 6:
-        return JalaliCalendarObject::tr("5Shanbe");
-        break;
-    case 7:
-        return JalaliCalendarObject::tr("Jome");
-        break;
-    }
+    static const char *names[7] = {
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Shanbe"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "1Shanbe"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "2Shanbe"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "3Shanbe"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "4Shanbe"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "5Shanbe"),
+        QT_TRANSLATE_NOOP("JalaliCalendarObject", "Jome")
+    };
 
-    return QString();
+    if( d<1 || d>7 )
+        return QString();
+
+    return JalaliCalendarObject::tr(names[d-1]);
 }
 
 qint64 AsemanCalendarConverterCore::fromDateJalali( qint64 year , int month , int day )
@@ -552,16 +763,9 @@ DateProperty AsemanCalendarConverterCore::toDateJalali( qint64 days_from_jalali_
     day++;
 
     bool leap = isLeapJalali(year);
-    for( int i=11 ; i>=0 ; i-- )
-    {
-        qint16 month_day = (leap)? aseman_jalali_leap_months_start[i] : aseman_jalali_months_start[i] ;
-        if( day > month_day )
-        {
-            month = i;
-            day  -= month_day;
-            break;
-        }
-    }
+    const int *months_start = (leap)? aseman_jalali_leap_months_start : aseman_jalali_months_start;
+    month = aseman_month_of_day( months_start, day-1 );
+    day  -= months_start[month];
 
     month++;
 
@@ -580,87 +784,50 @@ DateProperty AsemanCalendarConverterCore::toDateJalali( qint64 days_from_jalali_
 
 int AsemanCalendarConverterCore::leapIndexHijri( qint64 year )
 {
-    qint8 r = year%30;
-    for( int i=0 ; i<11 ; i++ )
-        if( r == aseman_hijri_leap_years[i] )
-            return i;
-
-    return -1;
+    // negative remainders never matched a leap year
+    const int r = year%30;
+    return r<0? -1 : aseman_hijri_leap_index[r];
 }
 
 QString AsemanCalendarConverterCore::monthNamesHijri( int m )
 {
-    switch( m )
-    {
-    case 1:
-        return "Moharram";
-        break;
-    case 2:
-        return "Safar";
-        break;
-    case 3:
-        return "Rabiol Avval";
-        break;
-    case 4:
-        return "Rabio Sani";
-        break;
-    case 5:
-        return "Jamadiol Aval";
-        break;
-    case 6:
-        return "Jamadio Sani";
-        break;
-    case 7:
-        return "Rajab";
-        break;
-    case 8:
-        return "Shaban";
-        break;
-    case 9:
-        return "Ramadan";
-        break;
-    case 10:
-        return "Shaval";
-        break;
-    case 11:
-        return "Zighade";
-        break;
-    case 12:
-        return "Zihaje";
-        break;
-    }
+    static const QString names[12] = {
+        QStringLiteral("Moharram"),
+        QStringLiteral("Safar"),
+        QStringLiteral("Rabiol Avval"),
+        QStringLiteral("Rabio Sani"),
+        QStringLiteral("Jamadiol Aval"),
+        QStringLiteral("Jamadio Sani"),
+        QStringLiteral("Rajab"),
+        QStringLiteral("Shaban"),
+        QStringLiteral("Ramadan"),
+        QStringLiteral("Shaval"),
+        QStringLiteral("Zighade"),
+        QStringLiteral("Zihaje")
+    };
 
-    return QString();
+    if( m<1 || m>12 )
+        return QString();
+
+    return names[m-1];
 }
 
 QString AsemanCalendarConverterCore::dayNameHijri(int d)
 {
-    switch( d )
-    {
-    case 1:
-        return "Saturday";
-        break;
-    case 2:
-        return "Sunday";
-        break;
-    case 3:
-        return "Monday";
-        break;
-    case 4:
-        return "Tuesday";
-        break;
-    case 5:
-        return "Wednesday";
-        break;
-    case 6:
-        return "Thuresday";
-        break;
-    case 7:
-        return "Friday";
-        break;
-    }
+    static const QString names[7] = {
+        QStringLiteral("Saturday"),
+        QStringLiteral("Sunday"),
+        QStringLiteral("Monday"),
+        QStringLiteral("Tuesday"),
+        QStringLiteral("Wednesday"),
+        QStringLiteral("Thuresday"),
+        QStringLiteral("Friday")
+    };
+
+    if( d<1 || d>7 )
+        return QString();
 
-    return QString();
+    return names[d-1];
 }
 
 qint64 AsemanCalendarConverterCore::leapsNumberHijri( qint64 year )
@@ -727,16 +894,9 @@ DateProperty AsemanCalendarConverterCore::toDateHijri( qint64 days_from_hijri_ze
 
     int leap_number = leapIndexHijri( year );
     bool leap = (leap_number!=-1);
-    for( int i=11 ; i>=0 ; i-- )
-    {
-        qint16 month_day = (leap)? aseman_hijri_leap_months_start[i] : aseman_hijri_months_start[i] ;
-        if( day > month_day )
-        {
-            month = i;
-            day  -= month_day;
-            break;
-        }
-    }
+    const int *months_start = (leap)? aseman_hijri_leap_months_start : aseman_hijri_months_start;
+    month = aseman_month_of_day( months_start, day-1 );
+    day  -= months_start[month];
 
     month++;
 
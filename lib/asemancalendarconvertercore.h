@@ -65,6 +65,8 @@ public:
     QString numberString( const QDate & d );
 
     DateProperty getDate( const QDate & d );
+    void getDates( const QDate *dates, int count, DateProperty *result );
+    void getDates( const qint64 *msecsSinceEpoch, int count, DateProperty *result );
     QDate toDate( qint64 year, int month, int day );
 
     QString dayName( int d );
@@ -74,6 +76,8 @@ public:
     int daysOfMonth( qint64 year, int month );
 
 private:
+    DateProperty convertDate( const QDate & d );
+
     qint64 fromDateGregorian( qint64 year , int month , int day );
     DateProperty toDateGregorian( qint64 days_from_julian_zero );
     bool isLeapGregorian( qint64 year );
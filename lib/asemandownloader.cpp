@@ -16,6 +16,10 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define DOWNLOADER_READ_BUFFER_SIZE (1024*1024)
+#define DOWNLOADER_PART_SUFFIX ".part"
+#define DOWNLOADER_MANIFEST_SUFFIX ".info"
+
 #include "asemandownloader.h"
 
 #include <QNetworkAccessManager>
@@ -25,12 +29,30 @@
 #include <QSslError>
 #include <QFile>
 #include <QDir>
+#include <QSettings>
+
+#include <cstdio>
+
+bool aseman_downloader_replace_file(const QString &src, const QString &dst)
+{
+#ifdef Q_OS_WIN
+    QFile::remove(dst);
+    return QFile::rename(src, dst);
+#else
+    return ::rename(QFile::encodeName(src).constData(), QFile::encodeName(dst).constData()) == 0;
+#endif
+}
 
 class AsemanDownloaderPrivate
 {
 public:
     QNetworkAccessManager *manager;
     QNetworkReply *reply;
+    QFile *file;
+    qint64 offset;
+    qint64 expected;
+    bool resumable;
+    bool accepted;
 
     qint64 recieved_bytes;
     qint64 total_bytes;
@@ -46,6 +68,11 @@ AsemanDownloader::AsemanDownloader(QObject *parent) :
 {
     p = new AsemanDownloaderPrivate;
     p->reply = 0;
+    p->file = 0;
+    p->offset = 0;
+    p->expected = -1;
+    p->resumable = false;
+    p->accepted = false;
     p->recieved_bytes = 0;
     p->total_bytes = 1;
     p->manager = 0;
@@ -104,6 +131,20 @@ int AsemanDownloader::downloaderId() const
     return p->downloader_id;
 }
 
+void AsemanDownloader::setResumable(bool stt)
+{
+    if( p->resumable == stt )
+        return;
+
+    p->resumable = stt;
+    Q_EMIT resumableChanged();
+}
+
+bool AsemanDownloader::resumable() const
+{
+    return p->resumable;
+}
+
 bool AsemanDownloader::downloading() const
 {
     return p->reply;
@@ -116,13 +157,57 @@ void AsemanDownloader::start()
     if( p->reply )
         return;
 
+    QNetworkRequest request = QNetworkRequest(QUrl(p->path));
+    p->offset = 0;
+    p->expected = -1;
+    p->accepted = true; // Non-HTTP replies may never report a status
+
+    if( !p->dest.isEmpty() )
+    {
+        QDir().mkpath( QFileInfo(p->dest).dir().path() );
+
+        const QString partPath = p->dest + DOWNLOADER_PART_SUFFIX;
+        QFile::OpenMode mode = QFile::WriteOnly|QFile::Truncate;
+        const qint64 partSize = QFileInfo(partPath).size();
+        if( p->resumable && partSize > 0 )
+        {
+            QSettings manifest(partPath + DOWNLOADER_MANIFEST_SUFFIX, QSettings::IniFormat);
+            QByteArray validator = manifest.value("etag").toByteArray();
+            if( validator.isEmpty() )
+                validator = manifest.value("lastModified").toByteArray();
+
+            if( manifest.value("url").toString() == p->path && !validator.isEmpty() )
+            {
+                p->offset = partSize;
+                p->expected = manifest.value("length", -1).toLongLong();
+                request.setRawHeader("Range", "bytes=" + QByteArray::number(p->offset) + "-");
+                request.setRawHeader("If-Range", validator);
+                mode = QFile::WriteOnly|QFile::Append;
+            }
+        }
+
+        p->file = new QFile(partPath);
+        if( !p->file->open(mode) )
+        {
+            closeFile(true);
+            Q_EMIT error( QStringList()<<"Can't write to file." );
+            Q_EMIT failed();
+            return;
+        }
+    }
+
     init_manager();
 
-    QNetworkRequest request = QNetworkRequest(QUrl(p->path));
     p->reply = p->manager->get(request);
 
     connect(p->reply, &QNetworkReply::sslErrors, this, &AsemanDownloader::sslErrors);
     connect(p->reply, &QNetworkReply::downloadProgress, this, &AsemanDownloader::downloadProgress);
+    if( p->file )
+    {
+        p->reply->setReadBufferSize(DOWNLOADER_READ_BUFFER_SIZE);
+        connect(p->reply, &QNetworkReply::metaDataChanged, this, &AsemanDownloader::metaDataChanged);
+        connect(p->reply, &QNetworkReply::readyRead, this, &AsemanDownloader::readyRead);
+    }
 
     Q_EMIT downloadingChanged();
 }
@@ -134,6 +219,7 @@ void AsemanDownloader::stop()
 
     p->reply->deleteLater();
     p->reply = 0;
+    closeFile(!p->resumable);
     p->recieved_bytes = 0;
     p->total_bytes = 1;
     Q_EMIT downloadingChanged();
@@ -150,8 +236,18 @@ void AsemanDownloader::downloadFinished(QNetworkReply *reply)
 
     p->reply->deleteLater();
     p->reply = 0;
-    if (reply->error())
+
+    // The server refuses a range which starts at the end of a completed part file
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool completed = (status == 416 && p->file && p->expected > 0 && p->offset == p->expected);
+
+    // Nothing but a 200 or 206 body belongs to the part file
+    if( p->file && !p->accepted )
+        p->file->resize(p->offset);
+
+    if( (reply->error() || (p->file && !p->accepted)) && !completed )
     {
+        closeFile(!p->resumable);
         Q_EMIT error( QStringList()<<"Failed" );
         Q_EMIT failed();
         Q_EMIT downloadingChanged();
@@ -161,28 +257,45 @@ void AsemanDownloader::downloadFinished(QNetworkReply *reply)
     p->recieved_bytes = 0;
     p->total_bytes = 1;
 
-    if( !p->dest.isEmpty() )
+    QByteArray res;
+    if( p->file )
     {
-        QDir().mkpath( QFileInfo(p->dest).dir().path() );
-        if( QFile::exists(p->dest) )
-            QFile::remove(p->dest);
+        const QString partPath = p->file->fileName();
+        bool written = completed || (p->file->write( reply->readAll() ) != -1);
+        written = written && p->file->flush();
+
+        const qint64 size = p->file->size();
+        const bool incomplete = (p->expected >= 0 && size != p->expected);
+        closeFile(!written || (incomplete && !p->resumable));
+
+        QString errorString;
+        if( !written )
+            errorString = "Can't write to file.";
+        else
+        if( incomplete )
+            errorString = "Incomplete download.";
+        else
+        if( !aseman_downloader_replace_file(partPath, p->dest) )
+        {
+            QFile::remove(partPath);
+            QFile::remove(partPath + DOWNLOADER_MANIFEST_SUFFIX);
+            errorString = "Can't write to file.";
+        }
+        else
+            QFile::remove(partPath + DOWNLOADER_MANIFEST_SUFFIX);
 
-        QFile file(p->dest);
-        if( !file.open(QFile::WriteOnly) )
+        if( !errorString.isEmpty() )
         {
-            Q_EMIT error( QStringList()<<"Can't write to file." );
+            Q_EMIT error( QStringList()<<errorString );
             Q_EMIT failed();
             Q_EMIT downloadingChanged();
             Q_EMIT totalBytesChanged();
             Q_EMIT recievedBytesChanged();
             return;
         }
-
-        file.write( reply->readAll() );
-        file.flush();
     }
-
-    const QByteArray & res = reply->readAll();
+    else
+        res = reply->readAll();
 
     Q_EMIT finished( res );
     Q_EMIT finishedWithId( p->downloader_id, res );
@@ -191,6 +304,117 @@ void AsemanDownloader::downloadFinished(QNetworkReply *reply)
     Q_EMIT recievedBytesChanged();
 }
 
+void AsemanDownloader::metaDataChanged()
+{
+    if( !p->reply || !p->file )
+        return;
+
+    const QVariant &statusVariant = p->reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    const int status = statusVariant.toInt();
+    p->accepted = (statusVariant.isNull() || status == 200 || status == 206);
+    if( status == 206 )
+    {
+        // Content-Range: bytes <first>-<last>/<total>
+        const QByteArray &range = p->reply->rawHeader("Content-Range");
+        const int space = range.indexOf(' ');
+        const int dash = range.indexOf('-');
+        const int slash = range.lastIndexOf('/');
+
+        bool totalOk = false;
+        const qint64 first = range.mid(space+1, dash-space-1).toLongLong();
+        const qint64 total = range.mid(slash+1).toLongLong(&totalOk);
+        if( first != p->offset )
+        {
+            QNetworkReply *reply = p->reply;
+            p->reply = 0;
+            reply->abort();
+            reply->deleteLater();
+
+            closeFile(true);
+            p->recieved_bytes = 0;
+            p->total_bytes = 1;
+            Q_EMIT error( QStringList()<<"Invalid range response." );
+            Q_EMIT failed();
+            Q_EMIT downloadingChanged();
+            Q_EMIT totalBytesChanged();
+            Q_EMIT recievedBytesChanged();
+            return;
+        }
+
+        p->expected = totalOk? total : -1;
+    }
+    else
+    if( p->accepted )
+    {
+        // The server sends the whole body, so the old part is useless
+        if( p->offset )
+        {
+            p->file->resize(0);
+            p->offset = 0;
+        }
+
+        const QVariant &length = p->reply->header(QNetworkRequest::ContentLengthHeader);
+        p->expected = length.isValid()? length.toLongLong() : -1;
+    }
+    else
+        return;
+
+    if( !p->resumable )
+        return;
+
+    QSettings manifest(p->file->fileName() + DOWNLOADER_MANIFEST_SUFFIX, QSettings::IniFormat);
+    manifest.setValue("url", p->path);
+    manifest.setValue("etag", p->reply->rawHeader("ETag"));
+    manifest.setValue("lastModified", p->reply->rawHeader("Last-Modified"));
+    manifest.setValue("length", p->expected);
+}
+
+void AsemanDownloader::readyRead()
+{
+    if( !p->reply || !p->file )
+        return;
+
+    // Error pages and other statuses must not end up in the part file
+    if( !p->accepted )
+    {
+        p->reply->readAll();
+        return;
+    }
+
+    if( p->file->write( p->reply->readAll() ) == -1 )
+    {
+        QNetworkReply *reply = p->reply;
+        p->reply = 0;
+        reply->abort();
+        reply->deleteLater();
+
+        closeFile(true);
+        p->recieved_bytes = 0;
+        p->total_bytes = 1;
+        Q_EMIT error( QStringList()<<"Can't write to file." );
+        Q_EMIT failed();
+        Q_EMIT downloadingChanged();
+        Q_EMIT totalBytesChanged();
+        Q_EMIT recievedBytesChanged();
+    }
+}
+
+void AsemanDownloader::closeFile(bool remove)
+{
+    if( !p->file )
+        return;
+
+    p->file->close();
+    if( remove )
+    {
+        p->file->remove();
+        QFile::remove(p->file->fileName() + DOWNLOADER_MANIFEST_SUFFIX);
+    }
+
+    delete p->file;
+    p->file = 0;
+}
+
 void AsemanDownloader::sslErrors(const QList<QSslError> &list)
 {
     QStringList res;
@@ -203,6 +427,10 @@ void AsemanDownloader::sslErrors(const QList<QSslError> &list)
 
 void AsemanDownloader::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
 {
+    bytesReceived += p->offset;
+    if( bytesTotal >= 0 )
+        bytesTotal += p->offset;
+
     if( p->total_bytes != bytesTotal )
     {
         p->total_bytes = bytesTotal;
@@ -226,5 +454,6 @@ void AsemanDownloader::init_manager()
 
 AsemanDownloader::~AsemanDownloader()
 {
+    closeFile(!p->resumable);
     delete p;
 }
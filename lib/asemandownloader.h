@@ -35,6 +35,7 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanDownloader : public QObject
     Q_PROPERTY(QString path READ path WRITE setPath NOTIFY pathChanged)
     Q_PROPERTY(int downloaderId READ downloaderId WRITE setDownloaderId NOTIFY downloaderIdChanged)
     Q_PROPERTY(bool downloading READ downloading NOTIFY downloadingChanged)
+    Q_PROPERTY(bool resumable READ resumable WRITE setResumable NOTIFY resumableChanged)
 
     Q_OBJECT
 public:
@@ -53,6 +54,9 @@ public:
     void setDownloaderId( int id );
     int downloaderId() const;
 
+    void setResumable( bool stt );
+    bool resumable() const;
+
     bool downloading() const;
 
 public Q_SLOTS:
@@ -66,6 +70,7 @@ Q_SIGNALS:
     void downloaderIdChanged();
     void pathChanged();
     void downloadingChanged();
+    void resumableChanged();
     void error( const QStringList & error );
     void finished( const QByteArray & data );
     void finishedWithId( int id, const QByteArray & data );
@@ -75,9 +80,12 @@ private Q_SLOTS:
     void downloadFinished(QNetworkReply *reply);
     void sslErrors(const QList<QSslError> &list);
     void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void metaDataChanged();
+    void readyRead();
 
 private:
     void init_manager();
+    void closeFile(bool remove);
 
 private:
     AsemanDownloaderPrivate *p;
@@ -16,26 +16,109 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define ENCRYPTER_CHUNK_SIZE (64*1024)
+
 #include "asemanencrypter.h"
 
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QScopedPointer>
+
 QByteArray AsemanEncrypter::encrypt(const QByteArray &data)
 {
+    if(!_encryptor)
+        return data;
+
     QByteArray result;
-    AsemanSimpleQtCryptor::Encryptor enc( _key, AsemanSimpleQtCryptor::SERPENT_32, AsemanSimpleQtCryptor::ModeCFB, AsemanSimpleQtCryptor::NoChecksum );
-    if(enc.encrypt( data, result, true ) == AsemanSimpleQtCryptor::NoError)
+    if(_encryptor->encrypt( data, result, true ) == AsemanSimpleQtCryptor::NoError)
         return result;
-    else
-        return data;
+
+    _encryptor->reset();
+    return data;
 }
 
 QByteArray AsemanEncrypter::decrypt(const QByteArray &data)
 {
+    if(!_decryptor)
+        return QByteArray();
+
     QByteArray result;
-    AsemanSimpleQtCryptor::Decryptor dec( _key, AsemanSimpleQtCryptor::SERPENT_32, AsemanSimpleQtCryptor::ModeCFB );
-    if(dec.decrypt( data, result, true ) == AsemanSimpleQtCryptor::NoError)
+    if(_decryptor->decrypt( data, result, true ) == AsemanSimpleQtCryptor::NoError)
         return result;
-    else
-        return QByteArray();
+
+    _decryptor->reset();
+    return QByteArray();
+}
+
+AsemanSimpleQtCryptor::CryptoDevice *AsemanEncrypter::createDevice(QIODevice *device, QObject *parent) const
+{
+    if(!_key)
+        return 0;
+
+    return new AsemanSimpleQtCryptor::CryptoDevice(device, _key, AsemanSimpleQtCryptor::SERPENT_32, AsemanSimpleQtCryptor::ModeCFB, parent);
+}
+
+bool AsemanEncrypter::encryptFile(const QString &source, const QString &destination)
+{
+    // The destination is replaced only after a complete write, so a failure keeps the old file
+    if(!_key || QFileInfo(source) == QFileInfo(destination))
+        return false;
+
+    QFile src(source);
+    QSaveFile dst(destination);
+    if(!src.open(QFile::ReadOnly) || !dst.open(QFile::WriteOnly))
+        return false;
+
+    QScopedPointer<AsemanSimpleQtCryptor::CryptoDevice> device(createDevice(&dst));
+    device->open(QIODevice::WriteOnly);
+
+    bool failed = false;
+    while(!failed && !src.atEnd())
+    {
+        const QByteArray &chunk = src.read(ENCRYPTER_CHUNK_SIZE);
+        failed = chunk.isEmpty() || device->write(chunk) != chunk.size();
+    }
+
+    device->close();
+    failed = failed || device->error() != AsemanSimpleQtCryptor::NoError;
+    if(failed)
+    {
+        dst.cancelWriting();
+        return false;
+    }
+
+    return dst.commit();
+}
+
+bool AsemanEncrypter::decryptFile(const QString &source, const QString &destination)
+{
+    if(!_key || QFileInfo(source) == QFileInfo(destination))
+        return false;
+
+    QFile src(source);
+    QSaveFile dst(destination);
+    if(!src.open(QFile::ReadOnly) || !dst.open(QFile::WriteOnly))
+        return false;
+
+    QScopedPointer<AsemanSimpleQtCryptor::CryptoDevice> device(createDevice(&src));
+    device->open(QIODevice::ReadOnly);
+
+    bool failed = false;
+    while(!failed && !device->atEnd())
+    {
+        const QByteArray &chunk = device->read(ENCRYPTER_CHUNK_SIZE);
+        failed = (device->error() != AsemanSimpleQtCryptor::NoError) || dst.write(chunk) != chunk.size();
+    }
+
+    device->close();
+    if(failed)
+    {
+        dst.cancelWriting();
+        return false;
+    }
+
+    return dst.commit();
 }
 
 void AsemanEncrypter::setKey(const QString &key)
@@ -45,6 +128,16 @@ void AsemanEncrypter::setKey(const QString &key)
 
     _keyStr = key;
     _key = QSharedPointer<AsemanSimpleQtCryptor::Key>(new AsemanSimpleQtCryptor::Key(_keyStr));
+
+    // The key schedule is built once here and the contexts are reused by every call
+    _key->expandKeySerpent();
+    _key->expandKeyMessage();
+    _key->keyMessage->expandKeySerpent();
+
+    // Tagged messages are rejected when changed; untagged ones are read only if not strict
+    _encryptor = QSharedPointer<AsemanSimpleQtCryptor::Encryptor>( new AsemanSimpleQtCryptor::Encryptor(_key, AsemanSimpleQtCryptor::SERPENT_32, AsemanSimpleQtCryptor::ModeCFB, AsemanSimpleQtCryptor::ChecksumHard) );
+    _decryptor = QSharedPointer<AsemanSimpleQtCryptor::Decryptor>( new AsemanSimpleQtCryptor::Decryptor(_key, AsemanSimpleQtCryptor::SERPENT_32, AsemanSimpleQtCryptor::ModeCFB) );
+    _decryptor->setRequireChecksum(_strict);
     Q_EMIT keyChanged();
 }
 
@@ -52,3 +145,20 @@ QString AsemanEncrypter::key() const
 {
     return _keyStr;
 }
+
+void AsemanEncrypter::setStrict(bool strict)
+{
+    if(_strict == strict)
+        return;
+
+    _strict = strict;
+    if(_decryptor)
+        _decryptor->setRequireChecksum(_strict);
+
+    Q_EMIT strictChanged();
+}
+
+bool AsemanEncrypter::strict() const
+{
+    return _strict;
+}
@@ -23,28 +23,44 @@
 
 #include "asemantools_global.h"
 
+class QIODevice;
+
 class LIBASEMANTOOLSSHARED_EXPORT AsemanEncrypter : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QString key READ key WRITE setKey NOTIFY keyChanged)
+    Q_PROPERTY(bool strict READ strict WRITE setStrict NOTIFY strictChanged)
 
 public:
-    AsemanEncrypter(QObject *parent = 0): QObject(parent){}
+    AsemanEncrypter(QObject *parent = 0): QObject(parent), _strict(false){}
     virtual ~AsemanEncrypter(){}
 
     void setKey(const QString &key);
     QString key() const;
 
+    void setStrict(bool strict);
+    bool strict() const;
+
+    // The returned device is not opened and is owned by the caller
+    AsemanSimpleQtCryptor::CryptoDevice *createDevice(QIODevice *device, QObject *parent = 0) const;
+
 public Q_SLOTS:
     QByteArray encrypt(const QByteArray &data);
     QByteArray decrypt(const QByteArray &data);
 
+    bool encryptFile(const QString &source, const QString &destination);
+    bool decryptFile(const QString &source, const QString &destination);
+
 Q_SIGNALS:
     void keyChanged();
+    void strictChanged();
 
 private:
     QString _keyStr;
+    bool _strict;
     QSharedPointer<AsemanSimpleQtCryptor::Key> _key;
+    QSharedPointer<AsemanSimpleQtCryptor::Encryptor> _encryptor;
+    QSharedPointer<AsemanSimpleQtCryptor::Decryptor> _decryptor;
 };
 
 #endif // ASEMANENCRYPTER_H
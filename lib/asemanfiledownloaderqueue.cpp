@@ -16,25 +16,130 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define DOWNLOADER_QUEUE_RETRY_LIMIT 3
+
 #include "asemanfiledownloaderqueue.h"
 #include "asemandownloader.h"
 
-#include <QQueue>
 #include <QStack>
 #include <QSet>
+#include <QMap>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QUrl>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+QSet<AsemanFileDownloaderQueue*> *aseman_file_downloader_queues = 0;
+
+bool aseman_file_downloader_link(const QString &src, const QString &dst)
+{
+#ifdef Q_OS_UNIX
+    if( ::link(QFile::encodeName(src).constData(), QFile::encodeName(dst).constData()) == 0 )
+        return true;
+#endif
+
+    // Copying to a temporary name, so a half copied file never looks complete
+    const QString &temp = dst + ".copy";
+    QFile::remove(temp);
+    if( !QFile::copy(src, temp) )
+        return false;
+    if( !QFile::rename(temp, dst) )
+    {
+        QFile::remove(temp);
+        return false;
+    }
+
+    return true;
+}
+
+class AsemanFileDownloaderQueueGuard
+{
+public:
+    AsemanFileDownloaderQueueGuard(QObject *queue): queue(queue) {}
+    QMutex mutex;
+    QObject *queue;
+};
+
+class AsemanFileDownloaderQueueLinker : public QRunnable
+{
+public:
+    AsemanFileDownloaderQueueLinker(const QSharedPointer<AsemanFileDownloaderQueueGuard> &guard, const QString &url,
+                                    const QString &source, const QString &destination, const QStringList &names) :
+        guard(guard),
+        url(url),
+        source(source),
+        destination(destination),
+        names(names)
+    {
+    }
+
+    void run()
+    {
+        QStringList done;
+        for(const QString &name: names)
+        {
+            const QString &path = destination + "/" + name;
+            if(QFile::exists(path) || aseman_file_downloader_link(source, path))
+                done << name;
+        }
+
+        QMutexLocker locker(&guard->mutex);
+        if(guard->queue)
+            QMetaObject::invokeMethod(guard->queue, "linkFinished", Qt::QueuedConnection, Q_ARG(QString, url),
+                                      Q_ARG(QString, source), Q_ARG(QStringList, names), Q_ARG(QStringList, done));
+    }
+
+private:
+    QSharedPointer<AsemanFileDownloaderQueueGuard> guard;
+    QString url;
+    QString source;
+    QString destination;
+    QStringList names;
+};
+
+typedef QPair<int,qint64> AsemanFileDownloaderQueueKey;
+
+class AsemanFileDownloaderQueueRequest
+{
+public:
+    AsemanFileDownloaderQueueRequest(): priority(0), sequence(0) {}
+    int priority;
+    qint64 sequence;
+};
 
 class AsemanFileDownloaderQueuePrivate
 {
 public:
     QStack<AsemanDownloader*> inactiveItems;
     QSet<AsemanDownloader*> activeItems;
-    QQueue<QString> queue;
-    QHash<QString, QSet<QString> > names;
+    QHash<QString, int> activeHosts;
+
+    QMap<AsemanFileDownloaderQueueKey, QString> queue;
+    QHash<QString, AsemanFileDownloaderQueueRequest> requests;
+    QHash<QString, QHash<QString,int> > names;
+    QHash<QString, QMap<int,int> > priorities;
+    QHash<QString, int> retries;
+    QSet<QString> linking;
+    qint64 sequence;
+
+    QHash<QString, AsemanFileDownloaderQueue*> delegates;
+    // url -> file name -> priority -> count, passed to the owner on cancel and re-download
+    QHash<QString, QHash<QString, QMap<int,int> > > delegatedNames;
+    QSharedPointer<AsemanFileDownloaderQueueGuard> guard;
 
     int capacity;
+    int hostCapacity;
+    int policy;
     QString destination;
 };
 
@@ -43,6 +148,14 @@ AsemanFileDownloaderQueue::AsemanFileDownloaderQueue(QObject *parent) :
 {
     p = new AsemanFileDownloaderQueuePrivate;
     p->capacity = 10;
+    p->hostCapacity = 0;
+    p->policy = Fifo;
+    p->sequence = 0;
+    p->guard = QSharedPointer<AsemanFileDownloaderQueueGuard>( new AsemanFileDownloaderQueueGuard(this) );
+
+    if(!aseman_file_downloader_queues)
+        aseman_file_downloader_queues = new QSet<AsemanFileDownloaderQueue*>();
+    aseman_file_downloader_queues->insert(this);
 }
 
 void AsemanFileDownloaderQueue::setCapacity(int cap)
@@ -52,6 +165,8 @@ void AsemanFileDownloaderQueue::setCapacity(int cap)
 
     p->capacity = cap;
     Q_EMIT capacityChanged();
+
+    next();
 }
 
 int AsemanFileDownloaderQueue::capacity() const
@@ -59,6 +174,45 @@ int AsemanFileDownloaderQueue::capacity() const
     return p->capacity;
 }
 
+void AsemanFileDownloaderQueue::setHostCapacity(int cap)
+{
+    if(p->hostCapacity == cap)
+        return;
+
+    p->hostCapacity = cap;
+    Q_EMIT hostCapacityChanged();
+
+    next();
+}
+
+int AsemanFileDownloaderQueue::hostCapacity() const
+{
+    return p->hostCapacity;
+}
+
+void AsemanFileDownloaderQueue::setPolicy(int policy)
+{
+    if(p->policy == policy)
+        return;
+
+    p->policy = policy;
+
+    p->queue.clear();
+    QHashIterator<QString, AsemanFileDownloaderQueueRequest> i(p->requests);
+    while(i.hasNext())
+    {
+        i.next();
+        p->queue.insert(queueKey(i.value()), i.key());
+    }
+
+    Q_EMIT policyChanged();
+}
+
+int AsemanFileDownloaderQueue::policy() const
+{
+    return p->policy;
+}
+
 void AsemanFileDownloaderQueue::setDestination(const QString &dest)
 {
     if(p->destination == dest)
@@ -75,8 +229,9 @@ QString AsemanFileDownloaderQueue::destination() const
     return p->destination;
 }
 
-void AsemanFileDownloaderQueue::download(const QString &url, const QString &fileName)
+void AsemanFileDownloaderQueue::download(const QString &url, const QString &fileName, int priority)
 {
+    // Downloaders only move complete and verified files to their final names
     if( QFileInfo(p->destination+"/"+fileName).exists() )
     {
         Q_EMIT progressChanged(url, fileName, 100);
@@ -84,36 +239,248 @@ void AsemanFileDownloaderQueue::download(const QString &url, const QString &file
         return;
     }
 
-    p->names[url].insert(fileName);
-    if(p->queue.contains(url))
+    // The body is downloaded and only the new name should be linked
+    if(p->linking.contains(url))
+    {
+        p->names[url][fileName]++;
+        return;
+    }
+
+    // Another queue with the same destination is downloading it already
+    AsemanFileDownloaderQueue *owner = p->delegates.value(url);
+    if(!owner && !p->names.contains(url))
+        owner = findOwner(url);
+    if(owner)
+    {
+        if(!p->delegates.contains(url))
+        {
+            p->delegates[url] = owner;
+            connect(owner, &AsemanFileDownloaderQueue::finished, this, &AsemanFileDownloaderQueue::delegateFinished, Qt::UniqueConnection);
+            connect(owner, &AsemanFileDownloaderQueue::progressChanged, this, &AsemanFileDownloaderQueue::delegateProgressChanged, Qt::UniqueConnection);
+            connect(owner, &AsemanFileDownloaderQueue::destroyed, this, &AsemanFileDownloaderQueue::delegateDestroyed, Qt::UniqueConnection);
+        }
+
+        p->delegatedNames[url][fileName][priority]++;
+        owner->download(url, fileName, priority);
+        return;
+    }
+
+    const bool pending = p->requests.contains(url);
+    const bool active = !pending && p->names.contains(url);
+
+    p->names[url][fileName]++;
+    p->priorities[url][priority]++;
+    if(active)
         return;
 
-    p->queue.append(url);
+    AsemanFileDownloaderQueueRequest request = p->requests.value(url);
+    if(pending)
+        p->queue.remove(queueKey(request));
+
+    request.priority = urlPriority(url);
+    if(!pending || p->policy == Lifo)
+        request.sequence = p->sequence++;
+
+    p->requests[url] = request;
+    p->queue.insert(queueKey(request), url);
+    next();
+}
+
+void AsemanFileDownloaderQueue::setPriority(const QString &url, int previous, int priority)
+{
+    if(p->delegates.contains(url))
+    {
+        // Any request of the url with the previous priority is the same for the owner
+        QMutableHashIterator<QString, QMap<int,int> > i(p->delegatedNames[url]);
+        while(i.hasNext())
+        {
+            QMap<int,int> &priorities = i.next().value();
+            if(!priorities.contains(previous))
+                continue;
+
+            if(--priorities[previous] <= 0)
+                priorities.remove(previous);
+            priorities[priority]++;
+            break;
+        }
+
+        p->delegates.value(url)->setPriority(url, previous, priority);
+        return;
+    }
+    if(!p->priorities.contains(url) || previous == priority)
+        return;
+
+    removePriority(url, previous);
+    p->priorities[url][priority]++;
+    updatePriority(url);
+}
+
+void AsemanFileDownloaderQueue::cancel(const QString &url, const QString &fileName, int priority)
+{
+    if(p->delegatedNames.value(url).contains(fileName))
+    {
+        AsemanFileDownloaderQueue *owner = p->delegates.value(url);
+        QHash<QString, QMap<int,int> > &names = p->delegatedNames[url];
+        QMap<int,int> &priorities = names[fileName];
+        if(!priorities.contains(priority))
+            priority = priorities.firstKey();
+        if(--priorities[priority] <= 0)
+            priorities.remove(priority);
+        if(priorities.isEmpty())
+            names.remove(fileName);
+        if(names.isEmpty())
+        {
+            p->delegatedNames.remove(url);
+            p->delegates.remove(url);
+        }
+
+        owner->cancel(url, fileName, priority);
+        return;
+    }
+    if(!p->names.contains(url))
+        return;
+
+    QHash<QString,int> &names = p->names[url];
+    if(!names.contains(fileName))
+        return;
+
+    removePriority(url, priority);
+    if(--names[fileName] > 0)
+    {
+        updatePriority(url);
+        return;
+    }
+
+    names.remove(fileName);
+    if(!names.isEmpty())
+    {
+        updatePriority(url);
+        return;
+    }
+
+    p->names.remove(url);
+    p->priorities.remove(url);
+    p->retries.remove(url);
+    if(p->linking.contains(url))
+        return;
+    if(p->requests.contains(url))
+    {
+        p->queue.remove(queueKey(p->requests.take(url)));
+        return;
+    }
+
+    AsemanDownloader *activeDownloader = 0;
+    for(AsemanDownloader *downloader: p->activeItems)
+        if(downloader->path() == url)
+        {
+            activeDownloader = downloader;
+            break;
+        }
+
+    if(activeDownloader)
+    {
+        // The downloader is resumable, so the part file stays for a later request
+        releaseDownloader(activeDownloader);
+        activeDownloader->stop();
+    }
+
     next();
 }
 
 void AsemanFileDownloaderQueue::finishedSlt(const QByteArray &data)
 {
+    Q_UNUSED(data)
     AsemanDownloader *downloader = static_cast<AsemanDownloader*>(sender());
-    if(!downloader)
+    if(!downloader || !p->activeItems.contains(downloader))
         return;
 
-    const QString &url = downloader->path();
-    const QSet<QString> names = p->names.value(url);
-    for(const QString &name: names)
+    const QString url = downloader->path();
+    const QString source = downloader->destination();
+
+    p->retries.remove(url);
+    releaseDownloader(downloader);
+
+    p->linking.insert(url);
+    linkNames(url, source);
+    next();
+}
+
+void AsemanFileDownloaderQueue::linkNames(const QString &url, const QString &source)
+{
+    const QString &sourceName = QFileInfo(source).fileName();
+    QStringList names;
+
+    const QList<QString> &keys = p->names.value(url).keys();
+    for(const QString &name: keys)
     {
-        QFile file(p->destination + "/" + name);
-        if(!file.open(QFile::WriteOnly))
+        if(name != sourceName)
+        {
+            names << name;
             continue;
+        }
 
-        file.write(data);
-        file.close();
+        p->names[url].remove(name);
         Q_EMIT finished(url, name);
     }
 
+    if(names.isEmpty())
+    {
+        p->names.remove(url);
+        p->priorities.remove(url);
+        p->linking.remove(url);
+        return;
+    }
+
+    // Body is written once, other names are linked (or copied) on the thread pool
+    QThreadPool::globalInstance()->start( new AsemanFileDownloaderQueueLinker(p->guard, url, source, p->destination, names) );
+}
+
+void AsemanFileDownloaderQueue::linkFinished(const QString &url, const QString &source, const QStringList &names, const QStringList &done)
+{
+    for(const QString &name: names)
+    {
+        if(p->names.contains(url))
+            p->names[url].remove(name);
+        if(done.contains(name))
+            Q_EMIT finished(url, name);
+    }
+
+    // Some names requested while linking
+    if(!p->names.value(url).isEmpty())
+    {
+        linkNames(url, source);
+        return;
+    }
+
     p->names.remove(url);
-    p->activeItems.remove(downloader);
-    p->inactiveItems.push(downloader);
+    p->priorities.remove(url);
+    p->linking.remove(url);
+}
+
+void AsemanFileDownloaderQueue::failedSlt()
+{
+    AsemanDownloader *downloader = static_cast<AsemanDownloader*>(sender());
+    if(!downloader || !p->activeItems.contains(downloader))
+        return;
+
+    // The partial file is kept by the downloader, so the retry continues from where it stopped
+    const QString &url = downloader->path();
+    releaseDownloader(downloader);
+    if(p->retries[url]++ < DOWNLOADER_QUEUE_RETRY_LIMIT)
+    {
+        AsemanFileDownloaderQueueRequest request;
+        request.priority = urlPriority(url);
+        request.sequence = p->sequence++;
+        p->requests[url] = request;
+        p->queue.insert(queueKey(request), url);
+    }
+    else
+    {
+        p->names.remove(url);
+        p->priorities.remove(url);
+        p->retries.remove(url);
+    }
+
     next();
 }
 
@@ -127,7 +494,7 @@ void AsemanFileDownloaderQueue::recievedBytesChanged()
     const qint64 recieved = downloader->recievedBytes();
     const qreal percent = ((qreal)recieved/total)*100;
     const QString &url = downloader->path();
-    const QSet<QString> names = p->names.value(url);
+    const QList<QString> names = p->names.value(url).keys();
     for(const QString &name: names)
         Q_EMIT progressChanged(url, name, percent);
 }
@@ -136,35 +503,198 @@ void AsemanFileDownloaderQueue::next()
 {
     while(!p->inactiveItems.isEmpty() && p->inactiveItems.count()+p->activeItems.count()>p->capacity)
         p->inactiveItems.pop()->deleteLater();
-    if(p->queue.isEmpty())
+
+    while(!p->queue.isEmpty() && p->activeItems.count() < p->capacity)
+    {
+        // Best request which its host has a free slot
+        QMap<AsemanFileDownloaderQueueKey, QString>::iterator i = p->queue.begin();
+        for(; i != p->queue.end(); i++)
+            if(p->hostCapacity <= 0 || p->activeHosts.value(QUrl(i.value()).host()) < p->hostCapacity)
+                break;
+        if(i == p->queue.end())
+            return;
+
+        AsemanDownloader *downloader = getDownloader();
+        if(!downloader)
+            return;
+
+        const QString url = i.value();
+        p->queue.erase(i);
+        p->requests.remove(url);
+
+        const QList<QString> &names = p->names.value(url).keys();
+        if(names.isEmpty())
+        {
+            releaseDownloader(downloader);
+            continue;
+        }
+
+        p->activeHosts[QUrl(url).host()]++;
+
+        // Lowest name is stable between runs, so an interrupted part file will be found again
+        downloader->setPath(url);
+        downloader->setDestination(p->destination + "/" + *std::min_element(names.constBegin(), names.constEnd()));
+        downloader->start();
+    }
+}
+
+void AsemanFileDownloaderQueue::delegateFinished(const QString &url, const QString &fileName)
+{
+    if(!p->delegatedNames.value(url).contains(fileName))
         return;
 
-    AsemanDownloader *downloader = getDownloader();
-    if(!downloader)
+    QHash<QString, QMap<int,int> > &names = p->delegatedNames[url];
+    names.remove(fileName);
+    if(names.isEmpty())
+    {
+        p->delegatedNames.remove(url);
+        p->delegates.remove(url);
+    }
+
+    Q_EMIT finished(url, fileName);
+}
+
+void AsemanFileDownloaderQueue::delegateProgressChanged(const QString &url, const QString &fileName, qreal percent)
+{
+    if(!p->delegatedNames.value(url).contains(fileName))
         return;
 
-    const QString &url = p->queue.takeFirst();
-    downloader->setPath(url);
-    downloader->start();
+    Q_EMIT progressChanged(url, fileName, percent);
+}
+
+void AsemanFileDownloaderQueue::delegateDestroyed(QObject *obj)
+{
+    // The owner queue is gone, so the delegated requests should be downloaded here
+    const QList<QString> urls = p->delegates.keys();
+    for(const QString &url: urls)
+    {
+        if(p->delegates.value(url) != obj)
+            continue;
+
+        const QHash<QString, QMap<int,int> > names = p->delegatedNames.take(url);
+        p->delegates.remove(url);
+
+        QHashIterator<QString, QMap<int,int> > i(names);
+        while(i.hasNext())
+        {
+            i.next();
+            QMapIterator<int,int> j(i.value());
+            while(j.hasNext())
+            {
+                j.next();
+                for(int k=0; k<j.value(); k++)
+                    download(url, i.key(), j.key());
+            }
+        }
+    }
+}
+
+AsemanFileDownloaderQueue *AsemanFileDownloaderQueue::findOwner(const QString &url) const
+{
+    for(AsemanFileDownloaderQueue *queue: *aseman_file_downloader_queues)
+        if(queue != this && queue->p->destination == p->destination && queue->p->names.contains(url))
+            return queue;
+
+    return 0;
 }
 
 AsemanDownloader *AsemanFileDownloaderQueue::getDownloader()
 {
-    if(!p->inactiveItems.isEmpty())
-        return p->inactiveItems.pop();
     if(p->activeItems.count() >= p->capacity)
         return 0;
+    if(!p->inactiveItems.isEmpty())
+    {
+        AsemanDownloader *result = p->inactiveItems.pop();
+        p->activeItems.insert(result);
+        return result;
+    }
 
     AsemanDownloader *result = new AsemanDownloader(this);
+    result->setResumable(true);
     p->activeItems.insert(result);
 
     connect(result, &AsemanDownloader::recievedBytesChanged, this, &AsemanFileDownloaderQueue::recievedBytesChanged);
     connect(result, &AsemanDownloader::finished, this, &AsemanFileDownloaderQueue::finishedSlt);
+    connect(result, &AsemanDownloader::failed, this, &AsemanFileDownloaderQueue::failedSlt);
 
     return result;
 }
 
+void AsemanFileDownloaderQueue::releaseDownloader(AsemanDownloader *downloader)
+{
+    if(!p->activeItems.remove(downloader))
+        return;
+
+    const QString &host = QUrl(downloader->path()).host();
+    if(p->activeHosts.contains(host) && --p->activeHosts[host] <= 0)
+        p->activeHosts.remove(host);
+
+    p->inactiveItems.push(downloader);
+}
+
+int AsemanFileDownloaderQueue::urlPriority(const QString &url) const
+{
+    // A shared url is as urgent as the most urgent request still waiting on it
+    const QMap<int,int> &priorities = p->priorities.value(url);
+    return priorities.isEmpty()? 0 : priorities.lastKey();
+}
+
+void AsemanFileDownloaderQueue::removePriority(const QString &url, int priority)
+{
+    if(!p->priorities.contains(url))
+        return;
+
+    QMap<int,int> &priorities = p->priorities[url];
+    if(priorities.contains(priority) && --priorities[priority] <= 0)
+        priorities.remove(priority);
+}
+
+void AsemanFileDownloaderQueue::updatePriority(const QString &url)
+{
+    if(!p->requests.contains(url))
+        return;
+
+    AsemanFileDownloaderQueueRequest &request = p->requests[url];
+    const int priority = urlPriority(url);
+    if(request.priority == priority)
+        return;
+
+    p->queue.remove(queueKey(request));
+    request.priority = priority;
+    p->queue.insert(queueKey(request), url);
+}
+
+AsemanFileDownloaderQueueKey AsemanFileDownloaderQueue::queueKey(const AsemanFileDownloaderQueueRequest &request) const
+{
+    // QMap keeps the lowest key first: higher priorities, then older (Fifo) or newer (Lifo) requests
+    return AsemanFileDownloaderQueueKey(-request.priority, p->policy==Lifo? -request.sequence : request.sequence);
+}
+
 AsemanFileDownloaderQueue::~AsemanFileDownloaderQueue()
 {
+    aseman_file_downloader_queues->remove(this);
+
+    p->guard->mutex.lock();
+    p->guard->queue = 0;
+    p->guard->mutex.unlock();
+
+    QHashIterator<QString, AsemanFileDownloaderQueue*> i(p->delegates);
+    while(i.hasNext())
+    {
+        i.next();
+        QHashIterator<QString, QMap<int,int> > j(p->delegatedNames.value(i.key()));
+        while(j.hasNext())
+        {
+            j.next();
+            QMapIterator<int,int> k(j.value());
+            while(k.hasNext())
+            {
+                k.next();
+                for(int m=0; m<k.value(); m++)
+                    i.value()->cancel(i.key(), j.key(), k.key());
+            }
+        }
+    }
+
     delete p;
 }
@@ -21,43 +21,76 @@
 
 #include <QObject>
 #include <QUrl>
+#include <QPair>
+#include <QStringList>
 
 #include "asemantools_global.h"
 
 class AsemanDownloader;
+class AsemanFileDownloaderQueueRequest;
 class AsemanFileDownloaderQueuePrivate;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanFileDownloaderQueue : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(int capacity READ capacity WRITE setCapacity NOTIFY capacityChanged)
+    Q_PROPERTY(int hostCapacity READ hostCapacity WRITE setHostCapacity NOTIFY hostCapacityChanged)
+    Q_PROPERTY(int policy READ policy WRITE setPolicy NOTIFY policyChanged)
     Q_PROPERTY(QString destination READ destination WRITE setDestination NOTIFY destinationChanged)
+    Q_ENUMS(Policy)
 
 public:
+    enum Policy {
+        Fifo,
+        Lifo
+    };
+
     AsemanFileDownloaderQueue(QObject *parent = 0);
     virtual ~AsemanFileDownloaderQueue();
 
     void setCapacity(int cap);
     int capacity() const;
 
+    void setHostCapacity(int cap);
+    int hostCapacity() const;
+
+    void setPolicy(int policy);
+    int policy() const;
+
     void setDestination(const QString &dest);
     QString destination() const;
 
 public Q_SLOTS:
-    void download(const QString &url, const QString &fileName);
+    void download(const QString &url, const QString &fileName, int priority = 0);
+    void setPriority(const QString &url, int previous, int priority);
+    void cancel(const QString &url, const QString &fileName, int priority = 0);
 
 Q_SIGNALS:
     void capacityChanged();
+    void hostCapacityChanged();
+    void policyChanged();
     void destinationChanged();
     void finished(const QString &url, const QString &fileName);
     void progressChanged(const QString &url, const QString &fileName, qreal percent);
 
 private Q_SLOTS:
     void finishedSlt( const QByteArray & data );
+    void failedSlt();
+    void linkFinished(const QString &url, const QString &source, const QStringList &names, const QStringList &done);
+    void delegateFinished(const QString &url, const QString &fileName);
+    void delegateProgressChanged(const QString &url, const QString &fileName, qreal percent);
+    void delegateDestroyed(QObject *obj);
     void recievedBytesChanged();
 
 private:
     void next();
     AsemanDownloader *getDownloader();
+    void releaseDownloader(AsemanDownloader *downloader);
+    void linkNames(const QString &url, const QString &source);
+    AsemanFileDownloaderQueue *findOwner(const QString &url) const;
+    int urlPriority(const QString &url) const;
+    void removePriority(const QString &url, int priority);
+    void updatePriority(const QString &url);
+    QPair<int,qint64> queueKey(const AsemanFileDownloaderQueueRequest &request) const;
 
 private:
     AsemanFileDownloaderQueuePrivate *p;
@@ -30,6 +30,11 @@ public:
     QString result;
     QString fileName;
     qreal percent;
+    int priority;
+
+    QPointer<AsemanFileDownloaderQueue> requestedQueue;
+    QString requestedSource;
+    QString requestedFileName;
 };
 
 AsemanFileDownloaderQueueItem::AsemanFileDownloaderQueueItem(QObject *parent) :
@@ -37,6 +42,7 @@ AsemanFileDownloaderQueueItem::AsemanFileDownloaderQueueItem(QObject *parent) :
 {
     p = new AsemanFileDownloaderQueueItemPrivate;
     p->percent = 0;
+    p->priority = 0;
 }
 
 void AsemanFileDownloaderQueueItem::setSource(const QString &url)
@@ -76,6 +82,24 @@ qreal AsemanFileDownloaderQueueItem::percent() const
     return p->percent;
 }
 
+void AsemanFileDownloaderQueueItem::setPriority(int priority)
+{
+    if(p->priority == priority)
+        return;
+
+    const int previous = p->priority;
+    p->priority = priority;
+    if(p->requestedQueue)
+        p->requestedQueue->setPriority(p->requestedSource, previous, p->priority);
+
+    Q_EMIT priorityChanged();
+}
+
+int AsemanFileDownloaderQueueItem::priority() const
+{
+    return p->priority;
+}
+
 void AsemanFileDownloaderQueueItem::setDownloaderQueue(AsemanFileDownloaderQueue *queue)
 {
     if(p->queue == queue)
@@ -114,6 +138,14 @@ void AsemanFileDownloaderQueueItem::finished(const QString &url, const QString &
     if(p->source != url || p->fileName != fileName)
         return;
 
+    // The request is served, nothing is left to cancel
+    if(p->requestedSource == url && p->requestedFileName == fileName)
+    {
+        p->requestedQueue = 0;
+        p->requestedSource.clear();
+        p->requestedFileName.clear();
+    }
+
     p->result = AsemanDevices::localFilesPrePath() + p->queue->destination() + "/" + fileName;
     Q_EMIT resultChanged();
 
@@ -132,15 +164,30 @@ void AsemanFileDownloaderQueueItem::progressChanged(const QString &url, const QS
 
 void AsemanFileDownloaderQueueItem::refresh()
 {
+    cancel();
     if(p->source.isEmpty() || p->fileName.isEmpty())
         return;
     if(!p->queue)
         return;
 
-    p->queue->download(p->source, p->fileName);
+    p->requestedQueue = p->queue;
+    p->requestedSource = p->source;
+    p->requestedFileName = p->fileName;
+    p->queue->download(p->source, p->fileName, p->priority);
+}
+
+void AsemanFileDownloaderQueueItem::cancel()
+{
+    if(p->requestedQueue)
+        p->requestedQueue->cancel(p->requestedSource, p->requestedFileName, p->priority);
+
+    p->requestedQueue = 0;
+    p->requestedSource.clear();
+    p->requestedFileName.clear();
 }
 
 AsemanFileDownloaderQueueItem::~AsemanFileDownloaderQueueItem()
 {
+    cancel();
     delete p;
 }
@@ -31,6 +31,7 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanFileDownloaderQueueItem : public QObject
     Q_PROPERTY(QString source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(QString fileName READ fileName WRITE setFileName NOTIFY fileNameChanged)
     Q_PROPERTY(qreal percent READ percent NOTIFY percentChanged)
+    Q_PROPERTY(int priority READ priority WRITE setPriority NOTIFY priorityChanged)
     Q_PROPERTY(AsemanFileDownloaderQueue* downloaderQueue READ downloaderQueue WRITE setDownloaderQueue NOTIFY downloaderQueueChanged)
     Q_PROPERTY(QString result READ result NOTIFY resultChanged)
 
@@ -46,6 +47,9 @@ public:
 
     qreal percent() const;
 
+    void setPriority(int priority);
+    int priority() const;
+
     void setDownloaderQueue(AsemanFileDownloaderQueue *queue);
     AsemanFileDownloaderQueue *downloaderQueue() const;
 
@@ -57,6 +61,7 @@ Q_SIGNALS:
     void resultChanged();
     void fileNameChanged();
     void percentChanged();
+    void priorityChanged();
 
 private Q_SLOTS:
     void finished(const QString &url, const QString &fileName);
@@ -64,6 +69,7 @@ private Q_SLOTS:
 
 private:
     void refresh();
+    void cancel();
 
 private:
     AsemanFileDownloaderQueueItemPrivate *p;
@@ -17,6 +17,7 @@
 */
 
 #include "asemanfilesystemmodel.h"
+#include "private/asemanfilesystemmodelcore.h"
 
 #include <QFileSystemWatcher>
 #include <QDir>
@@ -27,9 +28,16 @@
 #include <QFileInfo>
 #include <QTimerEvent>
 #include <QTimer>
+#include <QThread>
+#include <QThreadPool>
 #include <QDebug>
 #include <QUrl>
+#include <QSet>
 
+#include <algorithm>
+
+#define ASEMAN_FILESYSTEM_MOVE_LIMIT 64
+#define ASEMAN_FILESYSTEM_INSERT_LIMIT 64
 
 class AsemanFileSystemModelPrivate
 {
@@ -42,95 +50,41 @@ public:
     QStringList nameFilters;
     QString folder;
     int sortField;
+    bool asynchronous;
+    bool partial;
+    bool loading;
+    bool mimeSniffing;
 
     QList<QFileInfo> list;
     QMimeDatabase mdb;
 
+    QHash<QString, QHash<int,QVariant> > cache;
+    QSet<QString> sniffing;
+    QSharedPointer<AsemanFileSystemModelGuard> guard;
+
+    QAtomicInt generation;
+    QThread *thread;
+    AsemanFileSystemModelCore *core;
+
     QFileSystemWatcher *watcher;
     QTimer *refresh_timer;
 };
 
-class SortUnitType
+int aseman_longest_increasing_length(const QVector<int> &list)
 {
-public:
-    SortUnitType(): num(0){}
-    QChar ch;
-    quint64 num;
-};
-
-QList<SortUnitType> aseman_analize_file_name(const QString &fileName)
-{
-    QList<SortUnitType> res;
-    for(int i=0; i<fileName.length(); i++)
+    QVector<int> tails;
+    for(int value: list)
     {
-        const QChar &ch = fileName[i];
-        if(ch.isNumber())
-        {
-            int num = QString(ch).toInt();
-            if(res.isEmpty() || !res.last().ch.isNull() )
-                res << SortUnitType();
-
-            SortUnitType & resUnit = res[res.length()-1];
-            resUnit.num = resUnit.num*10 + num;
-        }
+        QVector<int>::iterator i = std::lower_bound(tails.begin(), tails.end(), value);
+        if(i == tails.end())
+            tails << value;
         else
-        {
-            SortUnitType unit;
-            unit.ch = ch;
-            res << unit;
-        }
+            *i = value;
     }
 
-    return res;
+    return tails.count();
 }
 
-AsemanFileSystemModelPrivate *fileListSort_private_data = 0;
-bool aseman_fileListSort(const QFileInfo &f1, const QFileInfo &f2)
-{
-    if(fileListSort_private_data->showDirsFirst)
-    {
-        if(f1.isDir() && !f2.isDir())
-            return true;
-        if(!f1.isDir() && f2.isDir())
-            return false;
-    }
-
-    const QString & s1 = f1.fileName();
-    const QString & s2 = f2.fileName();
-
-    const QList<SortUnitType> &ul1 = aseman_analize_file_name(s1);
-    const QList<SortUnitType> &ul2 = aseman_analize_file_name(s2);
-
-    for(int i=0; i<ul1.length() && i<ul2.length(); i++)
-    {
-        const SortUnitType &u1 = ul1.at(i);
-        const SortUnitType &u2 = ul2.at(i);
-
-        if(u1.ch.isNull() && !u2.ch.isNull())
-            return true;
-        if(!u1.ch.isNull() && u2.ch.isNull())
-            return false;
-        if(!u1.ch.isNull() && !u2.ch.isNull())
-        {
-            if(u1.ch < u2.ch)
-                return true;
-            if(u1.ch > u2.ch)
-                return false;
-        }
-        if(u1.ch.isNull() && u2.ch.isNull())
-        {
-            if(u1.num < u2.num)
-                return true;
-            if(u1.num > u2.num)
-                return false;
-        }
-    }
-
-    return ul1.length() < ul2.length();
-}
-
-
-
 AsemanFileSystemModel::AsemanFileSystemModel(QObject *parent) :
     AsemanAbstractListModel(parent)
 {
@@ -140,9 +94,19 @@ AsemanFileSystemModel::AsemanFileSystemModel(QObject *parent) :
     p->showDirsFirst = true;
     p->showFiles = true;
     p->showHidden = false;
-    p->sortField = AsemanFileSystemModel::Size;
+    p->sortField = AsemanFileSystemModel::Name;
+    p->asynchronous = false;
+    p->partial = false;
+    p->loading = false;
+    p->mimeSniffing = false;
+    p->guard = QSharedPointer<AsemanFileSystemModelGuard>( new AsemanFileSystemModelGuard(this) );
+    p->thread = 0;
+    p->core = 0;
     p->refresh_timer = 0;
 
+    qRegisterMetaType<AsemanFileSystemScanOptions>("AsemanFileSystemScanOptions");
+    qRegisterMetaType<AsemanFileSystemScanResult>("AsemanFileSystemScanResult");
+
     p->watcher = new QFileSystemWatcher(this);
 
     p->refresh_timer = new QTimer(this);
@@ -288,6 +252,60 @@ int AsemanFileSystemModel::sortField() const
     return p->sortField;
 }
 
+void AsemanFileSystemModel::setAsynchronous(bool stt)
+{
+    if(p->asynchronous == stt)
+        return;
+
+    p->asynchronous = stt;
+    Q_EMIT asynchronousChanged();
+
+    refresh();
+}
+
+bool AsemanFileSystemModel::asynchronous() const
+{
+    return p->asynchronous;
+}
+
+void AsemanFileSystemModel::setPartial(bool stt)
+{
+    if(p->partial == stt)
+        return;
+
+    p->partial = stt;
+    Q_EMIT partialChanged();
+}
+
+bool AsemanFileSystemModel::partial() const
+{
+    return p->partial;
+}
+
+void AsemanFileSystemModel::setMimeSniffing(bool stt)
+{
+    if(p->mimeSniffing == stt)
+        return;
+
+    p->mimeSniffing = stt;
+    for(QHash<int,QVariant> &roles: p->cache)
+        roles.remove(FileMime);
+    if(!p->list.isEmpty())
+        Q_EMIT dataChanged(index(0), index(p->list.count()-1), QVector<int>() << FileMime);
+
+    Q_EMIT mimeSniffingChanged();
+}
+
+bool AsemanFileSystemModel::mimeSniffing() const
+{
+    return p->mimeSniffing;
+}
+
+bool AsemanFileSystemModel::loading() const
+{
+    return p->loading;
+}
+
 QString AsemanFileSystemModel::parentFolder() const
 {
     return QFileInfo(p->folder).dir().absolutePath();
@@ -322,14 +340,6 @@ QVariant AsemanFileSystemModel::data(const QModelIndex &index, int role) const
         result = info.fileName();
         break;
 
-    case FileMime:
-        result = p->mdb.mimeTypeForFile(info.filePath()).name();
-        break;
-
-    case FileSize:
-        result = info.size();
-        break;
-
     case FileSuffix:
         result = info.suffix();
         break;
@@ -342,6 +352,40 @@ QVariant AsemanFileSystemModel::data(const QModelIndex &index, int role) const
         result = info.isDir();
         break;
 
+    case FileMime:
+    case FileSize:
+    case FileModifiedDate:
+    case FileCreatedDate:
+        result = cachedData(index.row(), info, role);
+        break;
+    }
+
+    return result;
+}
+
+QVariant AsemanFileSystemModel::cachedData(int row, const QFileInfo &info, int role) const
+{
+    QHash<int,QVariant> &roles = p->cache[info.filePath()];
+    QHash<int,QVariant>::const_iterator i = roles.constFind(role);
+    if(i != roles.constEnd())
+        return i.value();
+
+    QVariant result;
+    switch(role)
+    {
+    case FileMime:
+        result = p->mdb.mimeTypeForFile(info, QMimeDatabase::MatchExtension).name();
+        if(p->mimeSniffing && !info.isDir() && !p->sniffing.contains(info.filePath()))
+        {
+            p->sniffing.insert(info.filePath());
+            QThreadPool::globalInstance()->start( new AsemanFileSystemMimeSniffer(p->guard, info.filePath(), row) );
+        }
+        break;
+
+    case FileSize:
+        result = info.size();
+        break;
+
     case FileModifiedDate:
         result = info.lastModified();
         break;
@@ -351,6 +395,7 @@ QVariant AsemanFileSystemModel::data(const QModelIndex &index, int role) const
         break;
     }
 
+    roles[role] = result;
     return result;
 }
 
@@ -400,94 +445,266 @@ void AsemanFileSystemModel::reinit_buffer()
     if(p->showHidden)
         filter = filter | QDir::Hidden;
 
-    QStringList list;
-    if(filter && !p->folder.isEmpty())
-        list = QDir(p->folder).entryList(static_cast<QDir::Filter>(filter));
+    AsemanFileSystemScanOptions options;
+    options.folder = p->folder;
+    options.filter = filter;
+    options.nameFilters = p->nameFilters;
+    options.showDirsFirst = p->showDirsFirst;
+    options.sortField = p->sortField;
+    options.partial = p->partial;
+
+    // Any running scan is outdated now, so it will be canceled
+    const int generation = p->generation.fetchAndAddOrdered(1) + 1;
+    if(!p->asynchronous)
+    {
+        changed( AsemanFileSystemModelCore::scan(options) );
+        setLoading(false);
+        return;
+    }
 
-    QList<QFileInfo> res;
-    for(const QString &fileName: list)
-        res << QFileInfo(p->folder + "/" + fileName);
+    if(!p->core)
+    {
+        p->thread = new QThread(this);
+        p->core = new AsemanFileSystemModelCore(&p->generation);
+        p->core->moveToThread(p->thread);
 
-    if(!p->nameFilters.isEmpty())
-        for(int i=0; i<res.count(); i++)
-        {
-            const QFileInfo &inf = res.at(i);
-
-            QStringList suffixes;
-            if(!inf.suffix().isEmpty())
-                suffixes << inf.suffix();
-            else
-                suffixes = p->mdb.mimeTypeForFile(inf.filePath()).suffixes();
-
-            bool founded = inf.isDir();
-            for(const QString &sfx: suffixes)
-                if(p->nameFilters.contains("*."+sfx, Qt::CaseInsensitive))
-                {
-                    founded = true;
-                    break;
-                }
-
-            if(!founded)
+        connect(p->core, &AsemanFileSystemModelCore::listFound, this, &AsemanFileSystemModel::listFound, Qt::QueuedConnection);
+        connect(p->thread, &QThread::finished, p->core, &AsemanFileSystemModelCore::deleteLater);
+
+        p->thread->start(QThread::LowPriority);
+    }
+
+    setLoading(true);
+    QMetaObject::invokeMethod(p->core, "start", Qt::QueuedConnection, Q_ARG(int, generation),
+                              Q_ARG(AsemanFileSystemScanOptions, options));
+}
+
+void AsemanFileSystemModel::listFound(const AsemanFileSystemScanResult &result)
+{
+    if(result.generation != p->generation.load())
+        return;
+
+    changed(result.list);
+    if(result.finished)
+        setLoading(false);
+}
+
+void AsemanFileSystemModel::mimeFound(const QString &path, const QString &mime, int row)
+{
+    p->sniffing.remove(path);
+    if(!p->mimeSniffing || !p->cache.contains(path))
+        return;
+
+    QHash<int,QVariant> &roles = p->cache[path];
+    if(roles.value(FileMime).toString() == mime)
+        return;
+
+    roles[FileMime] = mime;
+    if(row >= p->list.count() || p->list.at(row).filePath() != path)
+    {
+        row = -1;
+        for( int i=0 ; i<p->list.count() ; i++ )
+            if( p->list.at(i).filePath() == path )
             {
-                res.removeAt(i);
-                i--;
+                row = i;
+                break;
             }
-        }
+    }
+    if(row < 0)
+        return;
 
-    fileListSort_private_data = p;
-    qStableSort(res.begin(), res.end(), aseman_fileListSort);
+    Q_EMIT dataChanged(index(row), index(row), QVector<int>() << FileMime);
+}
 
-    changed(res);
+void AsemanFileSystemModel::setLoading(bool stt)
+{
+    if(p->loading == stt)
+        return;
+
+    p->loading = stt;
+    Q_EMIT loadingChanged();
 }
 
 void AsemanFileSystemModel::changed(const QList<QFileInfo> &list)
 {
-    bool count_changed = (list.count()==p->list.count());
+    const bool count_changed = (list.count() != p->list.count());
 
-    for( int i=0 ; i<p->list.count() ; i++ )
+    QSet<QString> newKeys;
+    newKeys.reserve(list.count());
+    for(const QFileInfo &file: list)
+        newKeys.insert(file.filePath());
+
+    // Removing from the end, so the indexes of the remaining ranges stay valid
+    for( int i=p->list.count()-1 ; i>=0 ; i-- )
     {
-        const QFileInfo &file = p->list.at(i);
-        if( list.contains(file) )
+        if( newKeys.contains(p->list.at(i).filePath()) )
             continue;
 
-        beginRemoveRows(QModelIndex(), i, i);
-        p->list.removeAt(i);
-        i--;
+        int first = i;
+        while( first > 0 && !newKeys.contains(p->list.at(first-1).filePath()) )
+            first--;
+
+        for( int j=first ; j<=i ; j++ )
+            p->cache.remove(p->list.at(j).filePath());
+
+        beginRemoveRows(QModelIndex(), first, i);
+        p->list.erase(p->list.begin()+first, p->list.begin()+i+1);
         endRemoveRows();
+        i = first;
     }
 
-    QList<QFileInfo> temp_list = list;
-    for( int i=0 ; i<temp_list.count() ; i++ )
+    QHash<QString, int> oldRows;
+    oldRows.reserve(p->list.count());
+    for( int i=0 ; i<p->list.count() ; i++ )
+        oldRows[p->list.at(i).filePath()] = i;
+
+    QVector<int> targetRows;
+    QVector<QString> targetKeys;
+    targetRows.reserve(p->list.count());
+    targetKeys.reserve(p->list.count());
+    for(const QFileInfo &file: list)
     {
-        const QFileInfo &file = temp_list.at(i);
-        if( p->list.contains(file) )
+        const int row = oldRows.value(file.filePath(), -1);
+        if(row == -1)
             continue;
 
-        temp_list.removeAt(i);
-        i--;
+        targetRows << row;
+        targetKeys << file.filePath();
     }
-    while( p->list != temp_list )
-        for( int i=0 ; i<p->list.count() ; i++ )
+
+    const int movedRows = targetRows.count() - aseman_longest_increasing_length(targetRows);
+    if(movedRows > ASEMAN_FILESYSTEM_MOVE_LIMIT)
+    {
+        Q_EMIT layoutAboutToBeChanged();
+
+        QVector<int> newRows(targetRows.count());
+        QList<QFileInfo> sorted;
+        sorted.reserve(targetRows.count());
+        for( int i=0 ; i<targetRows.count() ; i++ )
         {
-            const QFileInfo &file = p->list.at(i);
-            int nw = temp_list.indexOf(file);
-            if( i == nw )
+            sorted << p->list.at(targetRows.at(i));
+            newRows[targetRows.at(i)] = i;
+        }
+
+        const QModelIndexList &from = persistentIndexList();
+        QModelIndexList to;
+        for(const QModelIndex &idx: from)
+            to << index(newRows.at(idx.row()), idx.column());
+
+        p->list = sorted;
+        changePersistentIndexList(from, to);
+
+        Q_EMIT layoutChanged();
+    }
+    else
+    if(movedRows > 0)
+    {
+        for( int i=0 ; i<targetKeys.count() ; i++ )
+        {
+            const QString &key = targetKeys.at(i);
+            if( p->list.at(i).filePath() == key )
                 continue;
 
-            beginMoveRows( QModelIndex(), i, i, QModelIndex(), nw>i?nw+1:nw );
-            p->list.move( i, nw );
+            int from = i+1;
+            while( p->list.at(from).filePath() != key )
+                from++;
+
+            int len = 1;
+            while( from+len < p->list.count() &&
+                   p->list.at(from+len).filePath() == targetKeys.at(i+len) )
+                len++;
+
+            beginMoveRows( QModelIndex(), from, from+len-1, QModelIndex(), i );
+            std::rotate(p->list.begin()+i, p->list.begin()+from, p->list.begin()+from+len);
             endMoveRows();
+            i += len-1;
         }
+    }
 
+    // The remaining rows are in the order of the new list now, only the new rows are missing
+    int insertRanges = 0;
     for( int i=0 ; i<list.count() ; i++ )
+        if( !oldRows.contains(list.at(i).filePath()) &&
+            (i == 0 || oldRows.contains(list.at(i-1).filePath())) )
+            insertRanges++;
+
+    if(insertRanges > ASEMAN_FILESYSTEM_INSERT_LIMIT)
+    {
+        // Too many ranges to insert one by one (e.g. partial scans), so all new rows are
+        // appended at once and moved to their places by a single layout change
+        const int oldCount = p->list.count();
+        beginInsertRows(QModelIndex(), oldCount, list.count()-1);
+        p->list.reserve(list.count());
+        for(const QFileInfo &file: list)
+            if( !oldRows.contains(file.filePath()) )
+                p->list << file;
+        endInsertRows();
+
+        Q_EMIT layoutAboutToBeChanged();
+
+        QVector<int> newRows(list.count());
+        QList<QFileInfo> merged;
+        merged.reserve(list.count());
+        int oldRow = 0;
+        int addedRow = oldCount;
+        for( int i=0 ; i<list.count() ; i++ )
+        {
+            const int row = oldRows.contains(list.at(i).filePath())? oldRow++ : addedRow++;
+            merged << p->list.at(row);
+            newRows[row] = i;
+        }
+
+        const QModelIndexList &from = persistentIndexList();
+        QModelIndexList to;
+        for(const QModelIndex &idx: from)
+            to << index(newRows.at(idx.row()), idx.column());
+
+        p->list = merged;
+        changePersistentIndexList(from, to);
+
+        Q_EMIT layoutChanged();
+    }
+    else
     {
-        const QFileInfo &file = list.at(i);
-        if( p->list.contains(file) )
+        for( int i=0 ; i<list.count() ; i++ )
+        {
+            if( oldRows.contains(list.at(i).filePath()) )
+                continue;
+
+            int last = i;
+            while( last+1 < list.count() && !oldRows.contains(list.at(last+1).filePath()) )
+                last++;
+
+            // Appended and rotated into place, so the list is never copied
+            const int oldCount = p->list.count();
+            beginInsertRows(QModelIndex(), i, last);
+            p->list.reserve(list.count());
+            for( int j=i ; j<=last ; j++ )
+                p->list << list.at(j);
+            std::rotate(p->list.begin()+i, p->list.begin()+oldCount, p->list.end());
+            endInsertRows();
+            i = last;
+        }
+    }
+
+    // Rows which are modified on the disk, get the new infos and lose their cached roles
+    for( int i=0 ; i<list.count() ; i++ )
+    {
+        if( !fileModified(p->list.at(i), list.at(i)) )
             continue;
 
-        beginInsertRows(QModelIndex(), i, i );
-        p->list.insert( i, file );
-        endInsertRows();
+        int last = i;
+        while( last+1 < list.count() && fileModified(p->list.at(last+1), list.at(last+1)) )
+            last++;
+
+        for( int j=i ; j<=last ; j++ )
+        {
+            p->list[j] = list.at(j);
+            p->cache.remove(list.at(j).filePath());
+        }
+
+        Q_EMIT dataChanged(index(i), index(last));
+        i = last;
     }
 
     if(count_changed)
@@ -496,7 +713,28 @@ void AsemanFileSystemModel::changed(const QList<QFileInfo> &list)
     Q_EMIT listChanged();
 }
 
+bool AsemanFileSystemModel::fileModified(const QFileInfo &oldInfo, const QFileInfo &newInfo) const
+{
+    if(oldInfo.lastModified() != newInfo.lastModified())
+        return true;
+    if(!oldInfo.isDir() && oldInfo.size() != newInfo.size())
+        return true;
+
+    return false;
+}
+
 AsemanFileSystemModel::~AsemanFileSystemModel()
 {
+    p->guard->mutex.lock();
+    p->guard->model = 0;
+    p->guard->mutex.unlock();
+
+    if(p->thread)
+    {
+        p->generation.ref();
+        p->thread->quit();
+        p->thread->wait();
+    }
+
     delete p;
 }
@@ -25,6 +25,7 @@
 
 #include "asemantools_global.h"
 
+class AsemanFileSystemScanResult;
 class AsemanFileSystemModelPrivate;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemModel : public AsemanAbstractListModel
 {
@@ -41,6 +42,10 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemModel : public AsemanAbstractL
     Q_PROPERTY(QString folder READ folder WRITE setFolder NOTIFY folderChanged)
     Q_PROPERTY(QString parentFolder READ parentFolder NOTIFY parentFolderChanged)
     Q_PROPERTY(int sortField READ sortField WRITE setSortField NOTIFY sortFieldChanged)
+    Q_PROPERTY(bool asynchronous READ asynchronous WRITE setAsynchronous NOTIFY asynchronousChanged)
+    Q_PROPERTY(bool partial READ partial WRITE setPartial NOTIFY partialChanged)
+    Q_PROPERTY(bool loading READ loading NOTIFY loadingChanged)
+    Q_PROPERTY(bool mimeSniffing READ mimeSniffing WRITE setMimeSniffing NOTIFY mimeSniffingChanged)
     Q_PROPERTY(int count READ count NOTIFY countChanged)
 
 public:
@@ -90,6 +95,17 @@ public:
     void setSortField(int field);
     int sortField() const;
 
+    void setAsynchronous(bool stt);
+    bool asynchronous() const;
+
+    void setPartial(bool stt);
+    bool partial() const;
+
+    bool loading() const;
+
+    void setMimeSniffing(bool stt);
+    bool mimeSniffing() const;
+
     QString parentFolder() const;
 
     const QFileInfo &id( const QModelIndex &index ) const;
@@ -114,13 +130,22 @@ Q_SIGNALS:
     void folderChanged();
     void parentFolderChanged();
     void sortFieldChanged();
+    void asynchronousChanged();
+    void partialChanged();
+    void loadingChanged();
+    void mimeSniffingChanged();
     void listChanged();
 
 private Q_SLOTS:
     void reinit_buffer();
+    void listFound(const AsemanFileSystemScanResult &result);
+    void mimeFound(const QString &path, const QString &mime, int row);
 
 private:
     void changed(const QList<QFileInfo> &list);
+    bool fileModified(const QFileInfo &oldInfo, const QFileInfo &newInfo) const;
+    QVariant cachedData(int row, const QFileInfo &info, int role) const;
+    void setLoading(bool stt);
 
 private:
     AsemanFileSystemModelPrivate *p;
@@ -16,16 +16,24 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#define MAX_ACTIVE_THREADS 4
 #define IMAGE_WIDTH 400
+#define COLOR_CACHE_SIZE 1024
+#define COLOR_CACHE_VERSION 2
+#define PALETTE_SIZE 5
 
 #include "asemanimagecoloranalizor.h"
 #include "asemandevices.h"
+#include "private/asemanimagecolorkernel.h"
 
 #include <QThread>
 #include <QCoreApplication>
 #include <QQueue>
 #include <QSet>
+#include <QCache>
+#include <QPointer>
+#include <QFile>
+#include <QDataStream>
+#include <QDateTime>
 #include <QImageReader>
 #include <QImage>
 #include <QFileInfo>
@@ -33,11 +41,24 @@
 
 AsemanImageColorAnalizorThread *colorizor_thread = 0;
 
+QString aseman_image_color_local_path(const QString &path)
+{
+    if(path.left(AsemanDevices::localFilesPrePath().size()) == AsemanDevices::localFilesPrePath())
+        return path.mid(AsemanDevices::localFilesPrePath().size());
+    return path;
+}
+
+qint64 aseman_image_color_mtime(const QString &path)
+{
+    return QFileInfo(aseman_image_color_local_path(path)).lastModified().toMSecsSinceEpoch();
+}
+
 class AsemanImageColorAnalizorPrivate
 {
 public:
     QUrl source;
     QColor color;
+    QVariantList palette;
     int method;
 };
 
@@ -49,8 +70,6 @@ AsemanImageColorAnalizor::AsemanImageColorAnalizor(QObject *parent) :
 
     if( !colorizor_thread )
         colorizor_thread = new AsemanImageColorAnalizorThread(QCoreApplication::instance());
-
-    connect( colorizor_thread, &AsemanImageColorAnalizorThread::found, this, &AsemanImageColorAnalizor::found);
 }
 
 QUrl AsemanImageColorAnalizor::source() const
@@ -100,19 +119,40 @@ QColor AsemanImageColorAnalizor::color() const
     return p->color;
 }
 
-void AsemanImageColorAnalizor::found(int method, const QString &path)
+QVariantList AsemanImageColorAnalizor::palette() const
+{
+    return p->palette;
+}
+
+QString AsemanImageColorAnalizor::cacheFile() const
+{
+    return colorizor_thread->cacheFile();
+}
+
+void AsemanImageColorAnalizor::setCacheFile(const QString &file)
+{
+    if( colorizor_thread->cacheFile() == file )
+        return;
+
+    colorizor_thread->setCacheFile(file);
+    Q_EMIT cacheFileChanged();
+}
+
+void AsemanImageColorAnalizor::found(int method, const QString &path, const QColor &color, const QVariantList &palette)
 {
     if( method != p->method )
         return;
     if( path != sourceString() )
         return;
 
-    const QHash<int, QHash<QString,QColor> > & results = colorizor_thread->results();
-    if( !results.contains(p->method) || !results.value(p->method).contains(sourceString()) )
+    p->color = color;
+    Q_EMIT colorChanged();
+
+    if( p->palette == palette )
         return;
 
-    p->color = results[p->method][sourceString()];
-    Q_EMIT colorChanged();
+    p->palette = palette;
+    Q_EMIT paletteChanged();
 }
 
 void AsemanImageColorAnalizor::start()
@@ -120,8 +160,7 @@ void AsemanImageColorAnalizor::start()
     if( p->source.isEmpty() )
         return;
 
-    colorizor_thread->analize(p->method, sourceString());
-    found(p->method,sourceString());
+    colorizor_thread->analize(p->method, sourceString(), this);
 }
 
 AsemanImageColorAnalizor::~AsemanImageColorAnalizor()
@@ -130,65 +169,121 @@ AsemanImageColorAnalizor::~AsemanImageColorAnalizor()
 }
 
 
+class AsemanImageColorResult
+{
+public:
+    AsemanImageColorResult(): mtime(0) {}
+    QColor color;
+    QVariantList palette;
+    qint64 mtime;
+};
+
+class AsemanImageColorRequest
+{
+public:
+    AsemanImageColorRequest(): mtime(0) {}
+    qint64 mtime;
+    QList< QPointer<AsemanImageColorAnalizor> > analizors;
+};
+
 class AsemanImageColorAnalizorThreadPrivate
 {
 public:
-    QHash<int, QHash<QString,QColor> > results;
+    QCache<AsemanImageColorKey, AsemanImageColorResult> results;
+    QString cacheFile;
 
-    QQueue< QPair<int,QString> > queue;
+    QHash<AsemanImageColorKey, AsemanImageColorRequest> requests;
+    QQueue<AsemanImageColorKey> queue;
     QSet<AsemanImageColorAnalizorCore*> cores;
     QQueue<AsemanImageColorAnalizorCore*> free_cores;
+    int maxCores;
 };
 
 AsemanImageColorAnalizorThread::AsemanImageColorAnalizorThread(QObject *parent) :
     QObject(parent)
 {
     p = new AsemanImageColorAnalizorThreadPrivate;
+    p->results.setMaxCost(COLOR_CACHE_SIZE);
+    p->maxCores = qMax(1, QThread::idealThreadCount());
 }
 
-const QHash<int, QHash<QString,QColor> > &AsemanImageColorAnalizorThread::results() const
+QString AsemanImageColorAnalizorThread::cacheFile() const
 {
-    return p->results;
+    return p->cacheFile;
 }
 
-void AsemanImageColorAnalizorThread::analize(int method, const QString &path)
+void AsemanImageColorAnalizorThread::setCacheFile(const QString &file)
 {
-    if( p->results.contains(method) && p->results.value(method).contains(path) )
+    if(p->cacheFile == file)
         return;
 
-    AsemanImageColorAnalizorCore *core = getCore();
-    if( !core )
+    saveCache();
+    p->cacheFile = file;
+    loadCache();
+}
+
+void AsemanImageColorAnalizorThread::analize(int method, const QString &path, AsemanImageColorAnalizor *analizor)
+{
+    const AsemanImageColorKey key(method, path);
+    const qint64 mtime = aseman_image_color_mtime(path);
+
+    AsemanImageColorResult *result = p->results.object(key);
+    if( result && result->mtime == mtime )
     {
-        QPair<int,QString> pair(method, path);
-        p->queue.append(pair);
+        analizor->found(method, path, result->color, result->palette);
         return;
     }
 
-    QMetaObject::invokeMethod( core, "analize", Qt::QueuedConnection, Q_ARG(int,method) , Q_ARG(QString,path) );
+    // Requests of the same image are answered by one analysis
+    const bool pending = p->requests.contains(key);
+    AsemanImageColorRequest &request = p->requests[key];
+    if( !request.analizors.contains(analizor) )
+        request.analizors << analizor;
+    if( pending )
+        return;
+
+    request.mtime = mtime;
+    p->queue.append(key);
+    startNext();
 }
 
-void AsemanImageColorAnalizorThread::found_slt(AsemanImageColorAnalizorCore *c, int method, const QString &source, const QColor & color)
+void AsemanImageColorAnalizorThread::found_slt(AsemanImageColorAnalizorCore *c, int method, const QString &source, const QColor & color, const QVariantList &palette)
 {
-    p->results[method][source] = color;
-    Q_EMIT found(method, source);
+    const AsemanImageColorKey key(method, source);
+    const AsemanImageColorRequest &request = p->requests.take(key);
+
+    AsemanImageColorResult *result = new AsemanImageColorResult;
+    result->color = color;
+    result->palette = palette;
+    result->mtime = request.mtime;
+    p->results.insert(key, result);
+
+    for(const QPointer<AsemanImageColorAnalizor> &analizor: request.analizors)
+        if(analizor)
+            analizor->found(method, source, color, palette);
 
     p->free_cores.append(c);
-    if( p->queue.isEmpty() )
-        return;
+    startNext();
+}
 
-    AsemanImageColorAnalizorCore *core = getCore();
-    if( !core )
-        return;
+void AsemanImageColorAnalizorThread::startNext()
+{
+    while( !p->queue.isEmpty() )
+    {
+        AsemanImageColorAnalizorCore *core = getCore();
+        if( !core )
+            return;
 
-    const QPair<int,QString> & pair = p->queue.takeFirst();
-    QMetaObject::invokeMethod( core, "analize", Qt::QueuedConnection, Q_ARG(int,pair.first), Q_ARG(QString,pair.second) );
+        const AsemanImageColorKey key = p->queue.takeFirst();
+        QMetaObject::invokeMethod( core, "analize", Qt::QueuedConnection, Q_ARG(int,key.first), Q_ARG(QString,key.second) );
+    }
 }
 
 AsemanImageColorAnalizorCore *AsemanImageColorAnalizorThread::getCore()
 {
     if( !p->free_cores.isEmpty() )
         return p->free_cores.takeFirst();
-    if( p->cores.count() > MAX_ACTIVE_THREADS )
+    if( p->cores.count() >= p->maxCores )
         return 0;
 
     QThread *thread = new QThread(this);
@@ -204,8 +299,60 @@ AsemanImageColorAnalizorCore *AsemanImageColorAnalizorThread::getCore()
     return core;
 }
 
+void AsemanImageColorAnalizorThread::loadCache()
+{
+    if(p->cacheFile.isEmpty())
+        return;
+
+    QFile file(p->cacheFile);
+    if(!file.open(QFile::ReadOnly))
+        return;
+
+    QDataStream stream(&file);
+    qint32 version = 0;
+    stream >> version;
+    if(version != COLOR_CACHE_VERSION)
+        return;
+
+    while(!stream.atEnd())
+    {
+        qint32 method = 0;
+        QString path;
+        AsemanImageColorResult *result = new AsemanImageColorResult;
+        stream >> method >> path >> result->mtime >> result->color >> result->palette;
+        if(stream.status() != QDataStream::Ok)
+        {
+            delete result;
+            break;
+        }
+
+        p->results.insert(AsemanImageColorKey(method, path), result);
+    }
+}
+
+void AsemanImageColorAnalizorThread::saveCache()
+{
+    if(p->cacheFile.isEmpty())
+        return;
+
+    QFile file(p->cacheFile);
+    if(!file.open(QFile::WriteOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream << static_cast<qint32>(COLOR_CACHE_VERSION);
+
+    const QList<AsemanImageColorKey> &keys = p->results.keys();
+    for(const AsemanImageColorKey &key: keys)
+    {
+        const AsemanImageColorResult *result = p->results.object(key);
+        stream << static_cast<qint32>(key.first) << key.second << result->mtime << result->color << result->palette;
+    }
+}
+
 AsemanImageColorAnalizorThread::~AsemanImageColorAnalizorThread()
 {
+    saveCache();
     for(AsemanImageColorAnalizorCore *core: p->cores)
     {
         QThread *thread = core->thread();
@@ -231,79 +378,36 @@ AsemanImageColorAnalizorCore::AsemanImageColorAnalizorCore(QObject *parent) :
 
 void AsemanImageColorAnalizorCore::analize(int method, const QString &pt)
 {
-    QString path = pt;
-    if(path.left(AsemanDevices::localFilesPrePath().size()) == AsemanDevices::localFilesPrePath())
-        path = path.mid(AsemanDevices::localFilesPrePath().size());
-
-    QImageReader image(path);
+    QImageReader image( aseman_image_color_local_path(pt) );
 
     QSize image_size = image.size();
-    qreal ratio = image_size.width()/(qreal)image_size.height();
-    image_size.setWidth( IMAGE_WIDTH );
-    image_size.setHeight( IMAGE_WIDTH/ratio );
+    if(image_size.isValid() && image_size.height() > 0)
+    {
+        qreal ratio = image_size.width()/(qreal)image_size.height();
+        image_size.setWidth( IMAGE_WIDTH );
+        image_size.setHeight( qMax<int>(1, IMAGE_WIDTH/ratio) );
+        image.setScaledSize( image_size );
+    }
 
-    image.setScaledSize( image_size );
     const QImage & img = image.read();
 
+    // Unreadable or fully filtered images give an invalid color
     QColor result;
-
-    switch( method )
-    {
-    case AsemanImageColorAnalizor::Normal:
+    QVariantList palette;
+    if( method == AsemanImageColorAnalizor::Palette )
     {
-        qreal sum_r = 0;
-        qreal sum_g = 0;
-        qreal sum_b = 0;
-        int count = 0;
-
-        for( int i=0 ; i<image_size.width(); i++ )
-        {
-            for( int j=0 ; j<image_size.height(); j++ )
-            {
-                QColor clr = img.pixel(i,j);
-                qreal mid = (clr.red()+clr.green()+clr.blue())/3;
-                if( mid > 180 || mid < 70 )
-                    continue;
-
-                sum_r += clr.red();
-                sum_g += clr.green();
-                sum_b += clr.blue();
-                count++;
-            }
-        }
-
-        result = QColor( sum_r/count, sum_g/count, sum_b/count );
+        palette = aseman_image_color_palette(img, PALETTE_SIZE);
+        if( !palette.isEmpty() )
+            result = palette.first().toMap().value("color").value<QColor>();
     }
-        break;
-
-    case AsemanImageColorAnalizor::MoreSaturation:
+    else
     {
-        qreal sum_r = 0;
-        qreal sum_g = 0;
-        qreal sum_b = 0;
-        int count = 0;
-
-        for( int i=0 ; i<image_size.width(); i++ )
-        {
-            for( int j=0 ; j<image_size.height(); j++ )
-            {
-                QColor clr = img.pixel(i,j);
-                if( clr.saturation() < 150 || clr.lightness() < 50 )
-                    continue;
-
-                sum_r += clr.red();
-                sum_g += clr.green();
-                sum_b += clr.blue();
-                count++;
-            }
-        }
-
-        result = QColor( sum_r/count, sum_g/count, sum_b/count );
-    }
-        break;
+        AsemanImageColorSums sums;
+        aseman_image_color_sums(img, method, sums);
+        result = sums.average();
     }
 
-    Q_EMIT found( this, method, path, result );
+    Q_EMIT found( this, method, pt, result, palette );
 }
 
 AsemanImageColorAnalizorCore::~AsemanImageColorAnalizorCore()
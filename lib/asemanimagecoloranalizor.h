@@ -23,6 +23,8 @@
 #include <QColor>
 #include <QHash>
 #include <QUrl>
+#include <QVariantList>
+#include <QPair>
 
 #include "asemantools_global.h"
 
@@ -32,13 +34,17 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanImageColorAnalizor : public QObject
     Q_OBJECT
     Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(QColor color READ color NOTIFY colorChanged)
+    Q_PROPERTY(QVariantList palette READ palette NOTIFY paletteChanged)
     Q_PROPERTY(int method READ method WRITE setMethod NOTIFY methodChanged)
+    Q_PROPERTY(QString cacheFile READ cacheFile WRITE setCacheFile NOTIFY cacheFileChanged)
     Q_ENUMS(Method)
+    friend class AsemanImageColorAnalizorThread;
 
 public:
     enum Method {
         Normal,
-        MoreSaturation
+        MoreSaturation,
+        Palette
     };
 
     AsemanImageColorAnalizor(QObject *parent = 0);
@@ -51,17 +57,23 @@ public:
     void setMethod( int m );
 
     QColor color() const;
+    QVariantList palette() const;
+
+    QString cacheFile() const;
+    void setCacheFile( const QString & file );
 
 Q_SIGNALS:
     void sourceChanged();
     void colorChanged();
+    void paletteChanged();
     void methodChanged();
+    void cacheFileChanged();
 
 private Q_SLOTS:
-    void found(int method, const QString & path );
     void start();
 
 private:
+    void found(int method, const QString & path, const QColor &color, const QVariantList &palette);
     QString sourceString() const;
 
 private:
@@ -69,6 +81,8 @@ private:
 };
 
 
+typedef QPair<int,QString> AsemanImageColorKey;
+
 class AsemanImageColorAnalizorThreadPrivate;
 class AsemanImageColorAnalizorThread : public QObject
 {
@@ -77,19 +91,20 @@ public:
     AsemanImageColorAnalizorThread(QObject *parent = 0);
     virtual ~AsemanImageColorAnalizorThread();
 
-    const QHash<int, QHash<QString, QColor> > &results() const;
+    QString cacheFile() const;
+    void setCacheFile( const QString & file );
 
 public Q_SLOTS:
-    void analize(int method, const QString & path );
-
-Q_SIGNALS:
-    void found( int method, const QString & path );
+    void analize(int method, const QString & path, AsemanImageColorAnalizor *analizor );
 
 private Q_SLOTS:
-    void found_slt(class AsemanImageColorAnalizorCore *core, int method, const QString & path , const QColor &color);
+    void found_slt(class AsemanImageColorAnalizorCore *core, int method, const QString & path , const QColor &color, const QVariantList &palette);
 
 private:
     AsemanImageColorAnalizorCore *getCore();
+    void startNext();
+    void loadCache();
+    void saveCache();
 
 private:
     AsemanImageColorAnalizorThreadPrivate *p;
@@ -108,7 +123,7 @@ public Q_SLOTS:
     void analize( int method, const QString & path );
 
 Q_SIGNALS:
-    void found(AsemanImageColorAnalizorCore *core, int method, const QString & path , const QColor &color);
+    void found(AsemanImageColorAnalizorCore *core, int method, const QString & path , const QColor &color, const QVariantList &palette);
 
 private:
     AsemanImageColorAnalizorCorePrivate *p;
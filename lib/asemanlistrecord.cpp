@@ -17,9 +17,6 @@
 */
 
 #include "asemanlistrecord.h"
-#include <iostream>
-
-#include <QChar>
 
 AsemanListRecord::AsemanListRecord()
 {
@@ -36,41 +33,34 @@ AsemanListRecord::AsemanListRecord( const QByteArray & record )
 
 void AsemanListRecord::operator<<( AsemanListRecord record )
 {
-    for( int i=0 ; record.count(); i++ )
-        operator <<( record[i] );
+    // Encoded fields are position independent, so they are moved as they are
+    const int ext = data.size();
+    data += record.data;
+    for( int i=1 ; i<record.offsets.count() ; i++ )
+        offsets << record.offsets.at(i) + ext;
 }
 
 void AsemanListRecord::operator<<( const QByteArray & str )
 {
-    list << strToRecord( str );
-    offsets << offsets.last() + list.last().size();
+    writeRecord( str );
 }
 
 void AsemanListRecord::operator<<( const QList<QByteArray> & list )
 {
+    int size = data.size();
+    for( int i=0 ; i<list.count() ; i++ )
+        size += list.at(i).size() + 12;
+
+    data.reserve( size );
     for( int i=0 ; i<list.count() ; i++ )
-        operator <<( list[i] );
+        writeRecord( list.at(i) );
 }
 
 QByteArray AsemanListRecord::operator[]( int index )
 {
-    QByteArray result = list.at(index);
-
-    int cnt = result.size();
-    for( int i=0 ; i<cnt ; i++ )
-    {
-        if( result.at(0)==',' )
-        {
-            result.remove(0,1);
-            break;
-        }
-        if( !QChar(result.at(0)).isNumber() )
-        {
-            break;
-        }
-        result.remove(0,1);
-    }
-    return result;
+    const int end = offsets.at(index+1);
+    const int head = recordHead( data.constData(), offsets.at(index), end );
+    return QByteArray::fromRawData( data.constData()+head, end-head );
 }
 
 QByteArray AsemanListRecord::at( int i )
@@ -101,6 +91,7 @@ QByteArray AsemanListRecord::takeFirst()
 QList<QByteArray> AsemanListRecord::mid( int index , int len )
 {
     QList<QByteArray> res;
+    res.reserve( len );
     for( int i=index ; i<index+len ; i++ )
         res << operator [](i);
 
@@ -114,8 +105,9 @@ QList<QByteArray> AsemanListRecord::toQByteArrayList()
 
 void AsemanListRecord::removeAt( int index )
 {
-    int shift_size = list.at(index).size();
-    list.removeAt( index );
+    const int shift_size = offsets.at(index+1) - offsets.at(index);
+    data.remove( offsets.at(index), shift_size );
+    offsets.removeAt( index+1 );
 
     for( int i=index+1 ; i<offsets.count() ; i++ )
         offsets[i] -= shift_size;
@@ -123,46 +115,34 @@ void AsemanListRecord::removeAt( int index )
 
 QByteArray AsemanListRecord::takeAt( int index )
 {
-    QByteArray tmp( at(index) );
+    // The view dies with the removal, so this one is a deep copy
+    const QByteArray &view = at(index);
+    QByteArray tmp( view.constData(), view.size() );
     removeAt( index );
     return tmp;
 }
 
 void AsemanListRecord::FromQByteArray( const QByteArray & str )
 {
-    int data_size = str.size();
-    bool ok;
-
-    int ext = offsets.last();
-    for( int i=0,j=0 ; i<data_size ; i++ )
-    {
-        if( str[i] == ',' )
-        {
-            QByteArray tmp = str.mid( j , i-j );
-            j += tmp.toInt( &ok );
-            offsets << j+ext;
+    const int ext = data.size();
+    const int data_size = str.size();
+    const char *d = str.constData();
 
-            if( j > i )
-                i=j;
-        }
-    }
+    data += str;
+    for( int i=recordEnd(d, data_size, 0) ; i!=-1 ; i=recordEnd(d, data_size, i) )
+        offsets << i+ext;
 
-    for( int i=0 ; i<offsets.count()-1 ; i++ )
-        list << str.mid( offsets[i] , offsets[i+1]-offsets[i] );
+    data.truncate( offsets.last() );
 }
 
 QByteArray AsemanListRecord::toQByteArray()
 {
-    QByteArray result;
-    for(const QByteArray &ba: list)
-        result += ba;
-
-    return result;
+    return data;
 }
 
 int AsemanListRecord::count()
 {
-    return list.count();
+    return offsets.count()-1;
 }
 
 int AsemanListRecord::size()
@@ -177,24 +157,48 @@ int AsemanListRecord::lenght()
 
 void AsemanListRecord::clear()
 {
-    list.clear();
+    data.clear();
     offsets.clear();
     offsets << 0;
 }
 
-QByteArray AsemanListRecord::strToRecord(const QByteArray &str )
+void AsemanListRecord::writeRecord( const QByteArray & str )
+{
+    // The length prefix counts its own digits too
+    const int body = str.size() + 1;
+    int digits = 1;
+    for( qint64 limit=10 ; body+digits>=limit ; limit*=10 )
+        digits++;
+
+    data += QByteArray::number( body+digits );
+    data += ',';
+    data += str;
+    offsets << data.size();
+}
+
+int AsemanListRecord::recordEnd( const char *data, int size, int pos )
 {
-    char str_size[13];
-    QByteArray record("0," + str);
-    int size;
+    if( pos>=size )
+        return -1;
+
+    int j = pos;
+    qint64 len = 0;
+    while( j<size && data[j]>='0' && data[j]<='9' && len<=size )
+        len = len*10 + data[j++] - '0';
+
+    // The length counts its own prefix and must end in the buffer, anything else is a broken tail
+    if( j>=size || data[j]!=',' || len<=j-pos || pos+len>size )
+        return -1;
 
-    do
-    {
-        size = record.count();
-        sprintf( str_size , "%d" , size  );
-        record = "," + str;
-        record.prepend( str_size );
-    }while( size != record.count() );
+    return static_cast<int>( pos+len );
+}
+
+int AsemanListRecord::recordHead( const char *data, int pos, int end )
+{
+    while( pos<end && data[pos]!=',' )
+        pos++;
+    if( pos<end )
+        pos++;
 
-    return record;
+    return pos;
 }
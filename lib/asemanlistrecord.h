@@ -21,7 +21,6 @@
 
 #include <QByteArray>
 #include <QList>
-#include <cstdio>
 
 class AsemanListRecord
 {
@@ -33,6 +32,7 @@ public:
     void operator<<( const QByteArray & str );
     void operator<<( const QList<QByteArray> & list );
 
+    // Fields are views into the record, valid until it changes or is destroyed
     QByteArray operator[]( int index );
     QByteArray at( int index );
     QByteArray last();
@@ -55,10 +55,15 @@ public:
     void clear();
 
 private:
-    QList<QByteArray> list;
+    QByteArray data;
     QList<int> offsets;
 
-    QByteArray strToRecord( const QByteArray & str );
+    void writeRecord( const QByteArray & str );
+
+    static int recordEnd( const char *data, int size, int pos );
+    static int recordHead( const char *data, int pos, int end );
+
+    friend class AsemanListRecordFile;
 };
 
 #endif // ASEMANLISTRECORD_H
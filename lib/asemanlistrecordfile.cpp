@@ -0,0 +1,211 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define LIST_RECORD_INDEX_MARK "\0IDX"
+#define LIST_RECORD_INDEX_MARK_SIZE 4
+
+#include "asemanlistrecordfile.h"
+#include "asemanlistrecord.h"
+
+#include <QFile>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+
+/*
+ * The index block follows the fields:
+ *   mark | field ends (quint32 LE) ... | count (quint32 LE) | mark
+ * The mark starts with a zero byte, so plain record parsers stop there.
+ */
+
+class AsemanListRecordFilePrivate
+{
+public:
+    QFile file;
+    const uchar *data;
+    int size;
+    int count;
+    const uchar *index;
+    QVector<int> offsets;
+    bool indexed;
+};
+
+AsemanListRecordFile::AsemanListRecordFile( const QString & path )
+{
+    p = new AsemanListRecordFilePrivate;
+    p->data = 0;
+    p->size = 0;
+    p->count = 0;
+    p->index = 0;
+    p->indexed = false;
+
+    if( !path.isEmpty() )
+        open( path );
+}
+
+bool AsemanListRecordFile::open( const QString & path )
+{
+    close();
+
+    p->file.setFileName( path );
+    if( !p->file.open(QFile::ReadOnly) )
+        return false;
+
+    const qint64 fileSize = p->file.size();
+    if( fileSize > 0x7fffffff )
+    {
+        p->file.close();
+        return false;
+    }
+    if( fileSize == 0 )
+    {
+        p->indexed = true;
+        return true;
+    }
+
+    p->data = p->file.map( 0, fileSize );
+    if( !p->data )
+    {
+        p->file.close();
+        return false;
+    }
+    p->size = static_cast<int>( fileSize );
+
+    // A valid trailing index is used in place, otherwise it is built on first use
+    const int markSize = LIST_RECORD_INDEX_MARK_SIZE;
+    if( p->size >= 2*markSize + 4 && memcmp(p->data + p->size - markSize, LIST_RECORD_INDEX_MARK, markSize) == 0 )
+    {
+        const quint32 count = qFromLittleEndian<quint32>( p->data + p->size - markSize - 4 );
+        const qint64 indexSize = 2*markSize + 4 + qint64(count)*4;
+        if( indexSize <= p->size && memcmp(p->data + p->size - indexSize, LIST_RECORD_INDEX_MARK, markSize) == 0 )
+        {
+            p->count = static_cast<int>( count );
+            p->index = p->data + p->size - indexSize + markSize;
+            p->size -= static_cast<int>( indexSize );
+            p->indexed = true;
+        }
+    }
+
+    return true;
+}
+
+void AsemanListRecordFile::close()
+{
+    if( p->data )
+        p->file.unmap( const_cast<uchar*>(p->data) );
+    if( p->file.isOpen() )
+        p->file.close();
+
+    p->data = 0;
+    p->size = 0;
+    p->count = 0;
+    p->index = 0;
+    p->offsets.clear();
+    p->indexed = false;
+}
+
+bool AsemanListRecordFile::isOpen() const
+{
+    return p->file.isOpen();
+}
+
+int AsemanListRecordFile::count()
+{
+    if( !p->indexed )
+        buildIndex();
+
+    return p->count;
+}
+
+QByteArray AsemanListRecordFile::at( int index )
+{
+    if( index < 0 || index >= count() )
+        return QByteArray();
+
+    int start, end;
+    if( p->index )
+    {
+        // Checked before the cast, a corrupt offset must not turn negative
+        const quint32 indexStart = index? qFromLittleEndian<quint32>(p->index + 4*(index-1)) : 0;
+        const quint32 indexEnd = qFromLittleEndian<quint32>( p->index + 4*index );
+        if( indexStart > indexEnd || indexEnd > static_cast<quint32>(p->size) )
+            return QByteArray();
+
+        start = static_cast<int>( indexStart );
+        end = static_cast<int>( indexEnd );
+    }
+    else
+    {
+        start = p->offsets.at(index);
+        end = p->offsets.at(index+1);
+    }
+
+    const char *data = reinterpret_cast<const char*>( p->data );
+    const int head = AsemanListRecord::recordHead( data, start, end );
+    return QByteArray::fromRawData( data+head, end-head );
+}
+
+bool AsemanListRecordFile::write( const QString & path, const AsemanListRecord & record )
+{
+    const int count = record.offsets.count()-1;
+    QByteArray index;
+    index.reserve( 2*LIST_RECORD_INDEX_MARK_SIZE + 4*(count+1) );
+    index.append( LIST_RECORD_INDEX_MARK, LIST_RECORD_INDEX_MARK_SIZE );
+
+    uchar number[4];
+    for( int i=1 ; i<=count ; i++ )
+    {
+        qToLittleEndian<quint32>( record.offsets.at(i), number );
+        index.append( reinterpret_cast<const char*>(number), 4 );
+    }
+    qToLittleEndian<quint32>( count, number );
+    index.append( reinterpret_cast<const char*>(number), 4 );
+    index.append( LIST_RECORD_INDEX_MARK, LIST_RECORD_INDEX_MARK_SIZE );
+
+    QFile file( path );
+    if( !file.open(QFile::WriteOnly) )
+        return false;
+
+    const bool done = file.write(record.data) == record.data.size() &&
+                      file.write(index) == index.size();
+    file.close();
+    if( !done )
+        file.remove();
+
+    return done;
+}
+
+void AsemanListRecordFile::buildIndex()
+{
+    const char *data = reinterpret_cast<const char*>( p->data );
+
+    p->offsets.clear();
+    p->offsets << 0;
+    for( int i=AsemanListRecord::recordEnd(data, p->size, 0) ; i!=-1 ; i=AsemanListRecord::recordEnd(data, p->size, i) )
+        p->offsets << i;
+
+    p->count = p->offsets.count()-1;
+    p->indexed = true;
+}
+
+AsemanListRecordFile::~AsemanListRecordFile()
+{
+    close();
+    delete p;
+}
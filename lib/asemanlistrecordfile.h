@@ -0,0 +1,53 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANLISTRECORDFILE_H
+#define ASEMANLISTRECORDFILE_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "asemantools_global.h"
+
+class AsemanListRecord;
+class AsemanListRecordFilePrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanListRecordFile
+{
+public:
+    AsemanListRecordFile( const QString & path = QString() );
+    virtual ~AsemanListRecordFile();
+
+    bool open( const QString & path );
+    void close();
+    bool isOpen() const;
+
+    int count();
+    // Fields are views into the mapped file, valid until it is closed
+    QByteArray at( int index );
+
+    // Writes the record with a trailing index, so it opens without a parse
+    static bool write( const QString & path, const AsemanListRecord & record );
+
+private:
+    void buildIndex();
+
+private:
+    AsemanListRecordFilePrivate *p;
+};
+
+#endif // ASEMANLISTRECORDFILE_H
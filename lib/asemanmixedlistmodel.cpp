@@ -21,10 +21,14 @@
 #include <QTimer>
 #include <QDebug>
 
+#include <algorithm>
+
 class AsemanMixedListModelPrivate
 {
 public:
     QList<QAbstractListModel*> models;
+    QHash<QAbstractListModel*, int> modelsIndex;
+    QVector<int> offsets; // offsets[i] is the first global row of models[i], last item is the total count
     QVariantList cachedList;
     QTimer *initTimer;
     bool inited;
@@ -41,6 +45,8 @@ AsemanMixedListModel::AsemanMixedListModel(QObject *parent) :
     p->initTimer->setSingleShot(true);
 
     connect(p->initTimer, &QTimer::timeout, this, &AsemanMixedListModel::reinit_prv);
+
+    refreshOffsets();
 }
 
 int AsemanMixedListModel::rowCount(const QModelIndex &parent) const
@@ -51,43 +57,39 @@ int AsemanMixedListModel::rowCount(const QModelIndex &parent) const
 
 QVariant AsemanMixedListModel::data(const QModelIndex &index, int role) const
 {
-    for(QAbstractListModel *model: p->models)
-    {
-        QModelIndex newIndex = mapToModelIndex(model, index);
-        if(!newIndex.isValid())
-            continue;
+    int localRow = 0;
+    const int modelIdx = findModel(index, &localRow);
+    if(modelIdx < 0)
+        return QVariant();
 
-        if(role == RolesModelObject)
-            return QVariant::fromValue<QObject*>(model);
-        else
-        if(role == RolesModelIndex)
-            return p->models.indexOf(model);
-        else
-        if(role == RolesModelName)
-            return model? model->objectName() : "";
-        else
-        if(role < Qt::UserRole)
-            return model->data(newIndex, role);
-        else
-        if(model->roleNames().contains(role))
-            return model->data(newIndex, role);
-    }
+    QAbstractListModel *model = p->models.at(modelIdx);
+    if(role == RolesModelObject)
+        return QVariant::fromValue<QObject*>(model);
+    else
+    if(role == RolesModelIndex)
+        return modelIdx;
+    else
+    if(role == RolesModelName)
+        return model? model->objectName() : "";
+    else
+    if(role < Qt::UserRole)
+        return model->data(model->index(localRow, index.column()), role);
+    else
+    if(model->roleNames().contains(role))
+        return model->data(model->index(localRow, index.column()), role);
 
     return QVariant();
 }
 
 bool AsemanMixedListModel::setData(const QModelIndex &index, const QVariant &value, int role)
 {
-    for(QAbstractListModel *model: p->models)
-    {
-        QModelIndex newIndex = mapToModelIndex(model, index);
-        if(!newIndex.isValid())
-            continue;
-
-        return model->setData(newIndex, value, role);
-    }
+    int localRow = 0;
+    const int modelIdx = findModel(index, &localRow);
+    if(modelIdx < 0)
+        return false;
 
-    return false;
+    QAbstractListModel *model = p->models.at(modelIdx);
+    return model->setData(model->index(localRow, index.column()), value, role);
 }
 
 QHash<qint32, QByteArray> AsemanMixedListModel::roleNames() const
@@ -105,10 +107,7 @@ QHash<qint32, QByteArray> AsemanMixedListModel::roleNames() const
 
 int AsemanMixedListModel::count() const
 {
-    int count = 0;
-    for(QAbstractListModel *model: p->models)
-        count += model->rowCount();
-    return count;
+    return p->offsets.last();
 }
 
 void AsemanMixedListModel::setModels(const QVariantList &list)
@@ -130,16 +129,13 @@ QVariantList AsemanMixedListModel::models() const
 
 Qt::ItemFlags AsemanMixedListModel::flags(const QModelIndex &index) const
 {
-    for(QAbstractListModel *model: p->models)
-    {
-        QModelIndex newIndex = mapToModelIndex(model, index);
-        if(!newIndex.isValid())
-            continue;
-
-        return model->flags(newIndex);
-    }
+    int localRow = 0;
+    const int modelIdx = findModel(index, &localRow);
+    if(modelIdx < 0)
+        return Qt::NoItemFlags;
 
-    return Qt::NoItemFlags;
+    QAbstractListModel *model = p->models.at(modelIdx);
+    return model->flags(model->index(localRow, index.column()));
 }
 
 bool AsemanMixedListModel::insertColumns(int column, int count, const QModelIndex &parent)
@@ -322,6 +318,10 @@ void AsemanMixedListModel::modelAboutToBeReset_slt()
 
 void AsemanMixedListModel::modelReset_slt()
 {
+    QAbstractListModel *model = qobject_cast<QAbstractListModel*>(sender());
+    if(model)
+        refreshOffsets(p->modelsIndex.value(model, 0));
+
     endResetModel();
     Q_EMIT countChanged();
 }
@@ -362,7 +362,10 @@ void AsemanMixedListModel::rowsInserted_slt(const QModelIndex &parent, int first
     Q_UNUSED(last)
     QAbstractListModel *model = qobject_cast<QAbstractListModel*>(sender());
     if(model)
+    {
+        shiftOffsets(model, last-first+1);
         endInsertRows();
+    }
 
     Q_EMIT countChanged();
 }
@@ -388,7 +391,10 @@ void AsemanMixedListModel::rowsRemoved_slt(const QModelIndex &parent, int first,
     Q_UNUSED(last)
     QAbstractListModel *model = qobject_cast<QAbstractListModel*>(sender());
     if(model)
+    {
+        shiftOffsets(model, first-last-1);
         endRemoveRows();
+    }
 
     Q_EMIT countChanged();
 }
@@ -401,6 +407,7 @@ void AsemanMixedListModel::modelDestroyed(QObject *obj)
 
     p->models.removeAll(model);
     p->cachedList.removeAll(QVariant::fromValue<QObject*>(obj));
+    refreshOffsets();
     Q_EMIT modelsChanged();
 }
 
@@ -467,6 +474,7 @@ void AsemanMixedListModel::reinit_prv()
         connect(model, &QAbstractListModel::rowsMoved, this, &AsemanMixedListModel::rowsMoved_slt);
         connect(model, &QAbstractListModel::rowsRemoved, this, &AsemanMixedListModel::rowsRemoved_slt);
     }
+    refreshOffsets();
     endResetModel();
     p->inited = true;
 }
@@ -508,16 +516,55 @@ int AsemanMixedListModel::mapToModel(QAbstractListModel *model, int row) const
 
 int AsemanMixedListModel::modelPad(QAbstractListModel *model) const
 {
-    int rowPad = 0;
-    for(QAbstractListModel *mdl: p->models)
-    {
-        if(mdl == model)
-            break;
+    const int idx = p->modelsIndex.value(model, -1);
+    if(idx < 0)
+        return p->offsets.last();
+    else
+        return p->offsets.at(idx);
+}
+
+int AsemanMixedListModel::findModel(const QModelIndex &index, int *localRow) const
+{
+    if(!index.isValid() || index.parent().isValid())
+        return -1;
 
-        rowPad += mdl->rowCount();
+    const int row = index.row();
+    if(row < 0 || row >= p->offsets.last())
+        return -1;
+
+    // Empty models share their offset with the next model, so the owner
+    // is the last model that its offset is lower or equal to the row.
+    QVector<int>::const_iterator i = std::upper_bound(p->offsets.constBegin(), p->offsets.constEnd(), row);
+    const int modelIdx = (i - p->offsets.constBegin()) - 1;
+    if(localRow)
+        *localRow = row - p->offsets.at(modelIdx);
+
+    return modelIdx;
+}
+
+void AsemanMixedListModel::refreshOffsets(int from)
+{
+    if(from == 0)
+    {
+        p->modelsIndex.clear();
+        for(int i=0; i<p->models.count(); i++)
+            p->modelsIndex[p->models.at(i)] = i;
     }
 
-    return rowPad;
+    p->offsets.resize(p->models.count()+1);
+    p->offsets[0] = 0;
+    for(int i=from; i<p->models.count(); i++)
+        p->offsets[i+1] = p->offsets.at(i) + p->models.at(i)->rowCount();
+}
+
+void AsemanMixedListModel::shiftOffsets(QAbstractListModel *model, int delta)
+{
+    const int idx = p->modelsIndex.value(model, -1);
+    if(idx < 0)
+        return;
+
+    for(int i=idx+1; i<p->offsets.count(); i++)
+        p->offsets[i] += delta;
 }
 
 AsemanMixedListModel::~AsemanMixedListModel()
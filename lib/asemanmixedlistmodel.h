@@ -96,6 +96,11 @@ protected:
     int mapToModel(QAbstractListModel *model, int row) const;
 
     int modelPad(QAbstractListModel *model) const;
+    int findModel(const QModelIndex &index, int *localRow = 0) const;
+
+private:
+    void refreshOffsets(int from = 0);
+    void shiftOffsets(QAbstractListModel *model, int delta);
 
 private:
     AsemanMixedListModelPrivate *p;
@@ -0,0 +1,69 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define NATURAL_SORT_CHAR_FLAG (Q_UINT64_C(1) << 63)
+#define NATURAL_SORT_MAX_NUMBER (NATURAL_SORT_CHAR_FLAG - 1)
+
+#include "asemannaturalsortkey.h"
+
+AsemanNaturalSortKey::AsemanNaturalSortKey()
+{
+}
+
+AsemanNaturalSortKey::AsemanNaturalSortKey(const QString &str)
+{
+    units.reserve(str.length());
+
+    bool inNumber = false;
+    const QChar *data = str.constData();
+    const int length = str.length();
+    for(int i=0; i<length; i++)
+    {
+        const QChar &ch = data[i];
+        if(!ch.isNumber())
+        {
+            units << (NATURAL_SORT_CHAR_FLAG | ch.unicode());
+            inNumber = false;
+            continue;
+        }
+
+        if(!inNumber)
+            units << 0;
+
+        quint64 &num = units.last();
+        const int digit = qMax(ch.digitValue(), 0);
+        num = (num > (NATURAL_SORT_MAX_NUMBER-digit)/10)? NATURAL_SORT_MAX_NUMBER : num*10 + digit;
+        inNumber = true;
+    }
+}
+
+int AsemanNaturalSortKey::compare(const AsemanNaturalSortKey &other) const
+{
+    const int count = qMin(units.count(), other.units.count());
+    const quint64 *u1 = units.constData();
+    const quint64 *u2 = other.units.constData();
+    for(int i=0; i<count; i++)
+    {
+        if(u1[i] < u2[i])
+            return -1;
+        if(u1[i] > u2[i])
+            return 1;
+    }
+
+    return units.count() - other.units.count();
+}
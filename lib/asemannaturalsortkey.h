@@ -0,0 +1,49 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANNATURALSORTKEY_H
+#define ASEMANNATURALSORTKEY_H
+
+#include <QString>
+#include <QVector>
+
+#include "asemantools_global.h"
+
+/*!
+ * Precomputed natural collation key. Every run of digits is stored as a
+ * single number unit and every other character as a character unit, so
+ * "file9" is lower than "file10". Numbers are lower than characters.
+ * Comparing two keys doesn't allocate anything.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanNaturalSortKey
+{
+public:
+    AsemanNaturalSortKey();
+    AsemanNaturalSortKey(const QString &str);
+
+    int compare(const AsemanNaturalSortKey &other) const;
+
+    bool operator<(const AsemanNaturalSortKey &other) const { return compare(other) < 0; }
+    bool operator==(const AsemanNaturalSortKey &other) const { return units == other.units; }
+    bool operator!=(const AsemanNaturalSortKey &other) const { return units != other.units; }
+
+private:
+    QVector<quint64> units;
+};
+
+#endif // ASEMANNATURALSORTKEY_H
@@ -1,3 +1,6 @@
+#define QML_IMAGE_CACHE_SIZE 65536 // KB
+#define QML_IMAGE_RESIZE_DELAY 150
+
 #include "asemanqmlimage.h"
 #include "asemantools.h"
 
@@ -6,7 +9,90 @@
 #include <QImageReader>
 #include <QImage>
 #include <QFileInfo>
-#include <QCryptographicHash>
+#include <QDateTime>
+#include <QCache>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QTimer>
+
+class AsemanQmlImageKey
+{
+public:
+    AsemanQmlImageKey(): modified(0), autoTransform(false) {}
+    QString path;
+    qint64 modified;
+    QSize size;
+    bool autoTransform;
+
+    bool operator==(const AsemanQmlImageKey &key) const {
+        return modified == key.modified && size == key.size && autoTransform == key.autoTransform && path == key.path;
+    }
+    bool operator!=(const AsemanQmlImageKey &key) const {
+        return !operator==(key);
+    }
+};
+
+inline uint qHash(const AsemanQmlImageKey &key, uint seed = 0)
+{
+    return qHash(key.path, seed) ^ qHash(key.modified) ^ qHash(key.size.width()*31 + key.size.height()) ^ key.autoTransform;
+}
+
+// Decoded images of all the items, used from the gui thread only
+static QCache<AsemanQmlImageKey, QImage> *aseman_qml_image_cache()
+{
+    static QCache<AsemanQmlImageKey, QImage> *cache = 0;
+    if(!cache)
+        cache = new QCache<AsemanQmlImageKey, QImage>(QML_IMAGE_CACHE_SIZE);
+    return cache;
+}
+
+static void aseman_qml_image_cache_insert(const AsemanQmlImageKey &key, const QImage &image)
+{
+    if(image.isNull() || aseman_qml_image_cache()->contains(key))
+        return;
+
+    const int cost = qMax<int>(1, image.byteCount()/1024);
+    aseman_qml_image_cache()->insert(key, new QImage(image), cost);
+}
+
+static QImage aseman_qml_image_decode(const AsemanQmlImageKey &key)
+{
+    QImageReader reader(key.path);
+    reader.setAutoTransform(key.autoTransform);
+    if(key.size.isValid())
+        reader.setScaledSize(key.size);
+    return reader.read();
+}
+
+class AsemanQmlImageGuard
+{
+public:
+    AsemanQmlImageGuard(QObject *item): item(item) {}
+    QMutex mutex;
+    QObject *item;
+};
+
+class AsemanQmlImageDecoder : public QRunnable
+{
+public:
+    AsemanQmlImageDecoder(const QSharedPointer<AsemanQmlImageGuard> &guard, const AsemanQmlImageKey &key): guard(guard), key(key) {}
+
+    void run() {
+        const QImage &image = aseman_qml_image_decode(key);
+
+        // The item clears the guard under this lock before destroying
+        QMutexLocker locker(&guard->mutex);
+        if(guard->item)
+            QMetaObject::invokeMethod(guard->item, "decodeFinished", Qt::QueuedConnection,
+                                      Q_ARG(QString, key.path), Q_ARG(qint64, key.modified), Q_ARG(QSize, key.size),
+                                      Q_ARG(bool, key.autoTransform), Q_ARG(QImage, image));
+    }
+
+private:
+    QSharedPointer<AsemanQmlImageGuard> guard;
+    AsemanQmlImageKey key;
+};
 
 class AsemanQmlImage::Private
 {
@@ -21,10 +107,21 @@ public:
     bool mirror;
     bool smooth;
     qreal progress;
+    int status;
     QMutex mutex;
 
-    QString cacheHash;
-    QImage cacheImage;
+    // Stat of the source, refreshed by refresh() only. modified is 0 when
+    // the time is unknown, like for the resources.
+    QString path;
+    bool exists;
+    qint64 modified;
+    QSize sourceSize;
+    QTimer *resizeTimer;
+
+    AsemanQmlImageKey imageKey;
+    AsemanQmlImageKey pendingKey;
+    QImage image;
+    QSharedPointer<AsemanQmlImageGuard> guard;
 };
 
 AsemanQmlImage::AsemanQmlImage(QQuickItem *parent) :
@@ -39,36 +136,37 @@ AsemanQmlImage::AsemanQmlImage(QQuickItem *parent) :
     p->verticalAlignment = 0;
     p->mirror = false;
     p->progress = 0;
+    p->status = Null;
     p->smooth = false;
+    p->exists = false;
+    p->modified = 0;
+    p->guard = QSharedPointer<AsemanQmlImageGuard>(new AsemanQmlImageGuard(this));
 //    setRenderTarget(FramebufferObject);
+
+    p->resizeTimer = new QTimer(this);
+    p->resizeTimer->setSingleShot(true);
+    p->resizeTimer->setInterval(QML_IMAGE_RESIZE_DELAY);
+
+    connect(p->resizeTimer, &QTimer::timeout, this, &AsemanQmlImage::load);
+    connect(this, &QQuickItem::widthChanged, this, &AsemanQmlImage::resized);
+    connect(this, &QQuickItem::heightChanged, this, &AsemanQmlImage::resized);
 }
 
 void AsemanQmlImage::paint(QPainter *painter)
 {
+    // Decoding is done by load() on the gui thread or the pool, never here
     p->mutex.lock();
-    QUrl source = p->source;
-    QSizeF paintSize = paintedSize();
+    const QImage image = p->image;
     p->mutex.unlock();
 
-    QString cacheHash = hash();
-    if(cacheHash != p->cacheHash)
-    {
-        QString path = AsemanTools::urlToLocalPath(source);
-        if(!QFileInfo::exists(path))
-            return;
-
-        QImageReader reader(path);
-        reader.setScaledSize(paintSize.toSize());
-
-        p->cacheImage = reader.read();
-        p->cacheHash = cacheHash;
-    }
+    if(image.isNull())
+        return;
 
-    qreal x = width()/2 - p->cacheImage.width()/2;
-    qreal y = height()/2 - p->cacheImage.height()/2;
+    qreal x = width()/2 - image.width()/2;
+    qreal y = height()/2 - image.height()/2;
 
 
-    painter->drawImage(x, y, p->cacheImage);
+    painter->drawImage(x, y, image);
 }
 
 void AsemanQmlImage::setSource(const QUrl &source)
@@ -264,9 +362,7 @@ qreal AsemanQmlImage::paintedWidth() const
 
 QSize AsemanQmlImage::imageSize() const
 {
-    QString path = AsemanTools::urlToLocalPath(p->source);
-    QImageReader reader(path);
-    return reader.size();
+    return p->sourceSize;
 }
 
 QSizeF AsemanQmlImage::paintedSize() const
@@ -331,29 +427,146 @@ qreal AsemanQmlImage::progress() const
     return p->progress;
 }
 
+int AsemanQmlImage::status() const
+{
+    return p->status;
+}
+
 void AsemanQmlImage::refresh()
 {
+    const QString &path = AsemanTools::urlToLocalPath(p->source);
+    const QFileInfo info(path);
+    const bool exists = !path.isEmpty() && info.exists();
+    const QDateTime &lastModified = info.lastModified();
+    const qint64 modified = exists && lastModified.isValid()? lastModified.toMSecsSinceEpoch() : 0;
+
+    // The header is read again only when the file is changed
+    if(path != p->path || exists != p->exists || modified != p->modified)
+    {
+        const QSize sourceSize = exists? QImageReader(path).size() : QSize();
+
+        p->mutex.lock();
+        p->path = path;
+        p->exists = exists;
+        p->modified = modified;
+        p->mutex.unlock();
+
+        if(sourceSize != p->sourceSize)
+        {
+            p->sourceSize = sourceSize;
+            Q_EMIT sourceSizeChanged();
+            Q_EMIT paintedSizeChanged();
+        }
+    }
+
+    load();
+}
+
+void AsemanQmlImage::load()
+{
+    p->resizeTimer->stop();
+
+    AsemanQmlImageKey key;
+    key.path = p->path;
+    key.modified = p->modified;
+    key.autoTransform = p->autoTransform;
+    if(p->sourceSize.isValid() && width() > 0 && height() > 0)
+        key.size = paintedSize().toSize();
+
+    if(key.path.isEmpty() || !p->exists)
+    {
+        p->pendingKey = AsemanQmlImageKey();
+        p->mutex.lock();
+        p->imageKey = key;
+        p->image = QImage();
+        p->mutex.unlock();
+
+        setStatus(key.path.isEmpty()? Null : Error);
+        update();
+        return;
+    }
+    // Without a geometry it would be decoded at the full size, so it waits for resized()
+    if(p->sourceSize.isValid() && !key.size.isValid())
+    {
+        p->pendingKey = AsemanQmlImageKey();
+        return;
+    }
+    if(key == p->imageKey || key == p->pendingKey)
+        return;
+
+    p->pendingKey = key;
+
+    QImage *cached = p->cache? aseman_qml_image_cache()->object(key) : 0;
+    if(cached || !p->asynchronous)
+    {
+        decodeFinished(key.path, key.modified, key.size, key.autoTransform, cached? *cached : aseman_qml_image_decode(key));
+        return;
+    }
+
+    // The old image is painted until the new one is decoded
+    p->progress = 0;
+    Q_EMIT progressChanged();
+    setStatus(Loading);
+
+    QThreadPool::globalInstance()->start( new AsemanQmlImageDecoder(p->guard, key) );
+}
+
+void AsemanQmlImage::resized()
+{
+    // Animations resize on every frame, so the old image is painted until the size settles.
+    // An item which paints nothing of its source yet, loads at once.
+    const bool painted = !p->image.isNull() && p->imageKey.path == p->path && p->imageKey.modified == p->modified;
+    if(!painted && p->pendingKey.path.isEmpty())
+        load();
+    else
+        p->resizeTimer->start();
+}
+
+void AsemanQmlImage::decodeFinished(const QString &path, qint64 modified, const QSize &size, bool autoTransform, const QImage &image)
+{
+    AsemanQmlImageKey key;
+    key.path = path;
+    key.modified = modified;
+    key.size = size;
+    key.autoTransform = autoTransform;
+
+    if(p->cache)
+        aseman_qml_image_cache_insert(key, image);
+
+    // Replaced by a newer request, it's only kept in the cache
+    if(key != p->pendingKey)
+        return;
+
+    p->pendingKey = AsemanQmlImageKey();
+    p->mutex.lock();
+    p->imageKey = key;
+    p->image = image;
+    p->mutex.unlock();
+
+    if(p->progress != 1)
+    {
+        p->progress = 1;
+        Q_EMIT progressChanged();
+    }
+
+    setStatus(image.isNull()? Error : Ready);
     update();
 }
 
-QString AsemanQmlImage::hash()
+void AsemanQmlImage::setStatus(int status)
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-    stream << p->asynchronous;
-    stream << p->autoTransform;
-    stream << p->cache;
-    stream << p->fillMode;
-    stream << p->horizontalAlignment;
-    stream << p->mirror;
-    stream << p->smooth;
-    stream << p->source;
-    stream << p->verticalAlignment;
+    if(p->status == status)
+        return;
 
-    return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+    p->status = status;
+    Q_EMIT statusChanged();
 }
 
 AsemanQmlImage::~AsemanQmlImage()
 {
+    p->guard->mutex.lock();
+    p->guard->item = 0;
+    p->guard->mutex.unlock();
+
     delete p;
 }
@@ -4,6 +4,7 @@
 #include <QQuickPaintedItem>
 #include <QUrl>
 #include <QVariant>
+#include <QImage>
 
 #include "asemantools_global.h"
 
@@ -11,6 +12,7 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanQmlImage : public QQuickPaintedItem
 {
     Q_OBJECT
     Q_ENUMS(FillMode)
+    Q_ENUMS(Status)
 
     Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(int fillMode READ fillMode WRITE setFillMode NOTIFY fillModeChanged)
@@ -24,6 +26,7 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanQmlImage : public QQuickPaintedItem
     Q_PROPERTY(qreal paintedWidth READ paintedWidth NOTIFY paintedSizeChanged)
     Q_PROPERTY(qreal paintedHeight READ paintedHeight NOTIFY paintedSizeChanged)
     Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(int status READ status NOTIFY statusChanged)
     Q_PROPERTY(bool smooth READ smooth WRITE setSmooth NOTIFY smoothChanged)
     Q_PROPERTY(QSize sourceSize READ imageSize NOTIFY sourceSizeChanged)
 
@@ -37,6 +40,13 @@ public:
         Tile
     };
 
+    enum Status {
+        Null,
+        Ready,
+        Loading,
+        Error
+    };
+
     AsemanQmlImage(QQuickItem *parent = Q_NULLPTR);
     virtual ~AsemanQmlImage();
 
@@ -79,6 +89,7 @@ public:
     QSizeF paintedSize() const;
 
     qreal progress() const;
+    int status() const;
 
 Q_SIGNALS:
     void sourceChanged();
@@ -94,12 +105,18 @@ Q_SIGNALS:
     void progressChanged();
     void smoothChanged();
     void sourceSizeChanged();
+    void statusChanged();
 
 public Q_SLOTS:
     void refresh();
 
-protected:
-    QString hash();
+private Q_SLOTS:
+    void load();
+    void resized();
+    void decodeFinished(const QString &path, qint64 modified, const QSize &size, bool autoTransform, const QImage &image);
+
+private:
+    void setStatus(int status);
 
 private:
     Private *p;
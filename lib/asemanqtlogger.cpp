@@ -16,7 +16,14 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define LOGGER_QUEUE_SIZE 4096
+#define LOGGER_BATCH_SIZE 65536
+#define LOGGER_FLUSH_INTERVAL 200
+#define LOGGER_DEFAULT_MAX_FILES 5
+#define LOGGER_REOPEN_INTERVAL 5000
+
 #include "asemanqtlogger.h"
+#include "private/asemanqtlogformat.h"
 
 #include <QDebug>
 #include <QFile>
@@ -25,73 +32,361 @@
 #include <QFileInfo>
 #include <QCoreApplication>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QReadWriteLock>
+#include <QThread>
+#include <QAtomicInteger>
+#include <QHash>
+#include <QtEndian>
+
+#include <cstring>
 
 QSet<AsemanQtLogger*> aseman_qt_logger_objs;
+QReadWriteLock aseman_qt_logger_objs_lock;
 QtMessageHandler aseman_qt_logger_previousHandler = 0;
 
 void asemanQtLoggerFnc(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
+    aseman_qt_logger_objs_lock.lockForRead();
     for(AsemanQtLogger *obj: aseman_qt_logger_objs)
         obj->logMsg(type,context,msg);
-    aseman_qt_logger_previousHandler(type, context, msg);
+    aseman_qt_logger_objs_lock.unlock();
+
+    if(aseman_qt_logger_previousHandler)
+        aseman_qt_logger_previousHandler(type, context, msg);
 }
 
+/*
+ * Bounded multi producer queue. Producers only take a slot with an atomic
+ * compare and swap. The consumer side must be used by one thread at a
+ * time, the logger makes it sure by the file mutex.
+ */
+class AsemanQtLoggerQueue
+{
+public:
+    AsemanQtLoggerQueue(int size): mask(size-1), enqueuePos(0), dequeuePos(0)
+    {
+        slots = new Slot[size];
+        for(int i=0; i<size; i++)
+            slots[i].sequence.store(i);
+    }
+    ~AsemanQtLoggerQueue()
+    {
+        delete [] slots;
+    }
+
+    bool push(const QByteArray &data)
+    {
+        quint32 pos = enqueuePos.load();
+        forever
+        {
+            Slot &slot = slots[pos & mask];
+            const qint32 diff = static_cast<qint32>(slot.sequence.loadAcquire() - pos);
+            if(diff == 0)
+            {
+                if(enqueuePos.testAndSetOrdered(pos, pos+1))
+                {
+                    slot.data = data;
+                    slot.sequence.storeRelease(pos+1);
+                    return true;
+                }
+            }
+            else
+            if(diff < 0)
+                return false;
+
+            pos = enqueuePos.load();
+        }
+    }
+
+    bool pop(QByteArray &data)
+    {
+        Slot &slot = slots[dequeuePos & mask];
+        if(static_cast<qint32>(slot.sequence.loadAcquire() - (dequeuePos+1)) < 0)
+            return false;
+
+        data.swap(slot.data);
+        slot.data.clear();
+        slot.sequence.storeRelease(dequeuePos + mask + 1);
+        dequeuePos++;
+        return true;
+    }
+
+    bool isEmpty() const
+    {
+        const Slot &slot = slots[dequeuePos & mask];
+        return static_cast<qint32>(slot.sequence.loadAcquire() - (dequeuePos+1)) < 0;
+    }
+
+private:
+    class Slot
+    {
+    public:
+        QAtomicInteger<quint32> sequence;
+        QByteArray data;
+    };
+
+    Slot *slots;
+    const quint32 mask;
+    QAtomicInteger<quint32> enqueuePos;
+    quint32 dequeuePos;
+};
+
+class AsemanQtLoggerWriter : public QThread
+{
+public:
+    AsemanQtLoggerWriter(AsemanQtLogger *logger): logger(logger), stopped(0), sleeping(0) {}
+
+    void stop()
+    {
+        stopped.store(1);
+        wake();
+        wait();
+    }
+
+    void wake()
+    {
+        if(!sleeping.loadAcquire())
+            return;
+
+        wakeMutex.lock();
+        wakeCondition.wakeOne();
+        wakeMutex.unlock();
+    }
+
+protected:
+    void run();
+
+private:
+    AsemanQtLogger *logger;
+    QAtomicInt stopped;
+    QAtomicInt sleeping;
+    QMutex wakeMutex;
+    QWaitCondition wakeCondition;
+};
+
 class AsemanQtLoggerPrivate
 {
 public:
+    AsemanQtLoggerPrivate(): queue(LOGGER_QUEUE_SIZE) {}
+
     QFile *file;
     QString path;
     QMutex file_mutex;
+
+    AsemanQtLoggerQueue queue;
+    AsemanQtLoggerWriter *writer;
+    QAtomicInt dropped;
+    QAtomicInt levels;
+    QAtomicInt overflowPolicy;
+
+    // Blocked senders wait here until the writer pops
+    QMutex spaceMutex;
+    QWaitCondition spaceCondition;
+    QAtomicInt blocked;
+
+    qint64 fileSize;
+    qint64 maxFileSize;
+    int maxFiles;
+    int rotationInterval;
+    qint64 openedAt;
+
+    int format;
+    QAtomicInt openedFormat;
+    QHash<QByteArray, quint32> strings;
 };
 
+void AsemanQtLoggerWriter::run()
+{
+    forever
+    {
+        const bool finishing = stopped.load();
+        logger->flush();
+        if(finishing)
+            break;
+
+        // The timeout covers a wake missed between the check and the wait
+        wakeMutex.lock();
+        sleeping.store(1);
+        if(logger->p->queue.isEmpty() && !stopped.load())
+            wakeCondition.wait(&wakeMutex, LOGGER_FLUSH_INTERVAL);
+        sleeping.store(0);
+        wakeMutex.unlock();
+    }
+}
+
+void aseman_qt_logger_append_string(QByteArray &res, const QByteArray &text)
+{
+    uchar size[4];
+    qToLittleEndian<quint32>(text.size(), size);
+    res.append(reinterpret_cast<const char*>(size), 4);
+    res.append(text);
+}
+
+// The queued form of a binary event. The writer thread interns its strings.
+QByteArray aseman_qt_logger_event(qint64 msecs, int level, const char *category, const char *file, int line, const char *function, const QByteArray &message)
+{
+    uchar head[21];
+    qToLittleEndian<qint64>(msecs, head);
+    head[8] = static_cast<uchar>(level);
+    qToLittleEndian<quint64>(reinterpret_cast<quintptr>(QThread::currentThreadId()), head+9);
+    qToLittleEndian<quint32>(line, head+17);
+
+    QByteArray res;
+    res.reserve(21 + 16 + message.size() + 128);
+    res.append(reinterpret_cast<const char*>(head), 21);
+    aseman_qt_logger_append_string(res, QByteArray::fromRawData(category, static_cast<int>(qstrlen(category))));
+    aseman_qt_logger_append_string(res, QByteArray::fromRawData(file, static_cast<int>(qstrlen(file))));
+    aseman_qt_logger_append_string(res, QByteArray::fromRawData(function, static_cast<int>(qstrlen(function))));
+    aseman_qt_logger_append_string(res, message);
+    return res;
+}
+
+void aseman_qt_logger_append_number(QByteArray &res, int number, int width)
+{
+    char buffer[12];
+    int pos = sizeof(buffer);
+    unsigned int v = number<0? 0u-static_cast<unsigned int>(number) : static_cast<unsigned int>(number);
+    do {
+        buffer[--pos] = static_cast<char>('0' + v%10);
+        v /= 10;
+    } while(v);
+    if(number < 0)
+        buffer[--pos] = '-';
+
+    for(int i=static_cast<int>(sizeof(buffer))-pos; i<width; i++)
+        res += '0';
+    res.append(buffer+pos, static_cast<int>(sizeof(buffer))-pos);
+}
+
+QByteArray aseman_qt_logger_text(const char *typeName, const char *file, int line, const char *function, const QString &msg)
+{
+    const QTime &time = QTime::currentTime();
+
+    QByteArray text;
+    text.reserve(msg.size() + 128);
+    text += typeName;
+    text += ": (";
+    text += file;
+    text += ':';
+    aseman_qt_logger_append_number(text, line, 0);
+    text += ", ";
+    text += function;
+    text += ") ";
+    aseman_qt_logger_append_number(text, time.hour(), 2);
+    text += ':';
+    aseman_qt_logger_append_number(text, time.minute(), 2);
+    text += ':';
+    aseman_qt_logger_append_number(text, time.second(), 2);
+    text += " : ";
+    text += msg.toUtf8();
+    text += '\n';
+    return text;
+}
+
 AsemanQtLogger::AsemanQtLogger(const QString &path, QObject *parent) :
     QObject(parent)
 {
     p = new AsemanQtLoggerPrivate;
     p->path = path;
     p->file = 0;
+    p->writer = 0;
+    p->levels.store(AllLevels);
+    p->overflowPolicy.store(DropMessages);
+    p->fileSize = 0;
+    p->maxFileSize = 0;
+    p->maxFiles = LOGGER_DEFAULT_MAX_FILES;
+    p->rotationInterval = 0;
+    p->openedAt = 0;
+    p->format = TextFormat;
+    p->openedFormat.store(TextFormat);
 
+    QWriteLocker locker(&aseman_qt_logger_objs_lock);
     aseman_qt_logger_objs.insert(this);
 }
 
 void AsemanQtLogger::logMsg(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
-    QString file = context.file;
-    QByteArray localMsg = msg.toLocal8Bit();
-    QString text = QString(": (%2:%3, %4) %5 : %1\n").arg(localMsg.constData())
-            .arg(file.mid(file.lastIndexOf("/")+1))
-            .arg(context.line).arg(context.function).arg(QTime::currentTime().toString());
-
+    const char *typeName = 0;
+    int level = 0;
     switch (static_cast<int>(type)) {
     case QtDebugMsg:
-        text = "Debug" + text;
-        p->file_mutex.lock();
-        p->file->write(text.toUtf8());
-        p->file->flush();
-        p->file_mutex.unlock();
+        typeName = "Debug";
+        level = DebugLevel;
+        break;
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+    case QtInfoMsg:
+        typeName = "Info";
+        level = InfoLevel;
         break;
+#endif
     case QtWarningMsg:
-        text = "Warning" + text;
-        p->file_mutex.lock();
-        p->file->write(text.toUtf8());
-        p->file->flush();
-        p->file_mutex.unlock();
+        typeName = "Warning";
+        level = WarningLevel;
         break;
     case QtCriticalMsg:
-        text = "Critical" + text;
-        p->file_mutex.lock();
-        p->file->write(text.toUtf8());
-        p->file->flush();
-        p->file_mutex.unlock();
+        typeName = "Critical";
+        level = CriticalLevel;
         break;
     case QtFatalMsg:
-        text = "Fatal" + text;
+        typeName = "Fatal";
+        level = FatalLevel;
+        break;
+    default:
+        return;
+    }
+
+    const bool fatal = (type == QtFatalMsg);
+    if(!p->writer || (!fatal && !(p->levels.load() & level)))
+        return;
+
+    // Built in one buffer, it's the only work on the sender thread
+    const char *file = context.file? context.file : "";
+    const char *fileName = strrchr(file, '/');
+    const char *function = context.function? context.function : "";
+    const bool binary = (p->openedFormat.load() == BinaryFormat);
+
+    QByteArray text;
+    if(binary)
+        text = aseman_qt_logger_event(QDateTime::currentMSecsSinceEpoch(), level, context.category? context.category : "",
+                                      fileName? fileName+1 : file, context.line, function, msg.toUtf8());
+    else
+        text = aseman_qt_logger_text(typeName, fileName? fileName+1 : file, context.line, function, msg);
+
+    if(fatal)
+    {
+        // Written on this thread, the process is going down right after
         p->file_mutex.lock();
-        p->file->write(text.toUtf8());
-        p->file->flush();
+        drain();
+        QByteArray batch;
+        append(batch, text);
+        write(batch);
         p->file_mutex.unlock();
         abort();
     }
+
+    while(!p->queue.push(text))
+    {
+        p->writer->wake();
+        if(p->overflowPolicy.load() == DropMessages || QThread::currentThread() == p->writer)
+        {
+            p->dropped.ref();
+            return;
+        }
+
+        // Tried again after it's marked blocked, the timeout covers a wake missed anyway
+        p->spaceMutex.lock();
+        p->blocked.ref();
+        const bool pushed = p->queue.push(text);
+        if(!pushed)
+            p->spaceCondition.wait(&p->spaceMutex, LOGGER_FLUSH_INTERVAL);
+        p->blocked.deref();
+        p->spaceMutex.unlock();
+        if(pushed)
+            break;
+    }
+
+    p->writer->wake();
 }
 
 QString AsemanQtLogger::path() const
@@ -99,6 +394,99 @@ QString AsemanQtLogger::path() const
     return p->path;
 }
 
+void AsemanQtLogger::setLevels(int levels)
+{
+    if(p->levels.load() == levels)
+        return;
+
+    p->levels.store(levels);
+    Q_EMIT levelsChanged();
+}
+
+int AsemanQtLogger::levels() const
+{
+    return p->levels.load();
+}
+
+void AsemanQtLogger::setOverflowPolicy(int overflowPolicy)
+{
+    if(p->overflowPolicy.load() == overflowPolicy)
+        return;
+
+    p->overflowPolicy.store(overflowPolicy);
+    Q_EMIT overflowPolicyChanged();
+}
+
+int AsemanQtLogger::overflowPolicy() const
+{
+    return p->overflowPolicy.load();
+}
+
+void AsemanQtLogger::setMaxFileSize(qint64 maxFileSize)
+{
+    QMutexLocker locker(&p->file_mutex);
+    if(p->maxFileSize == maxFileSize)
+        return;
+
+    p->maxFileSize = maxFileSize;
+    locker.unlock();
+    Q_EMIT maxFileSizeChanged();
+}
+
+qint64 AsemanQtLogger::maxFileSize() const
+{
+    QMutexLocker locker(&p->file_mutex);
+    return p->maxFileSize;
+}
+
+void AsemanQtLogger::setMaxFiles(int maxFiles)
+{
+    QMutexLocker locker(&p->file_mutex);
+    if(p->maxFiles == maxFiles)
+        return;
+
+    p->maxFiles = maxFiles;
+    locker.unlock();
+    Q_EMIT maxFilesChanged();
+}
+
+int AsemanQtLogger::maxFiles() const
+{
+    QMutexLocker locker(&p->file_mutex);
+    return p->maxFiles;
+}
+
+void AsemanQtLogger::setRotationInterval(int rotationInterval)
+{
+    QMutexLocker locker(&p->file_mutex);
+    if(p->rotationInterval == rotationInterval)
+        return;
+
+    p->rotationInterval = rotationInterval;
+    locker.unlock();
+    Q_EMIT rotationIntervalChanged();
+}
+
+int AsemanQtLogger::rotationInterval() const
+{
+    QMutexLocker locker(&p->file_mutex);
+    return p->rotationInterval;
+}
+
+void AsemanQtLogger::setFormat(int format)
+{
+    if(p->format == format)
+        return;
+
+    p->format = format;
+    Q_EMIT formatChanged();
+}
+
+int AsemanQtLogger::format() const
+{
+    return p->format;
+}
+
 void AsemanQtLogger::debug(const QVariant &var)
 {
     qDebug() << var;
@@ -109,8 +497,12 @@ void AsemanQtLogger::start()
     if(p->file)
         return;
 
+    p->openedFormat.store(p->format);
     p->file = new QFile(p->path);
-    p->file->open(QFile::WriteOnly);
+    open();
+
+    p->writer = new AsemanQtLoggerWriter(this);
+    p->writer->start(QThread::LowPriority);
 
     if(aseman_qt_logger_previousHandler)
         return;
@@ -118,15 +510,188 @@ void AsemanQtLogger::start()
     aseman_qt_logger_previousHandler = qInstallMessageHandler(asemanQtLoggerFnc);
 }
 
+void AsemanQtLogger::flush()
+{
+    QMutexLocker locker(&p->file_mutex);
+    drain();
+}
+
+void AsemanQtLogger::drain()
+{
+    if(!p->file)
+        return;
+
+    // The queue is drained anyway, the messages are lost until the file opens
+    if(!p->file->isOpen() && QDateTime::currentMSecsSinceEpoch() - p->openedAt >= LOGGER_REOPEN_INTERVAL)
+        open();
+
+    QByteArray batch;
+    const int dropped = p->dropped.fetchAndStoreRelaxed(0);
+    if(dropped)
+    {
+        const QByteArray &message = QByteArray::number(dropped) + " log messages dropped, the queue was full";
+        if(p->openedFormat.load() == BinaryFormat)
+            append(batch, aseman_qt_logger_event(QDateTime::currentMSecsSinceEpoch(), WarningLevel, "", "", 0, "", message));
+        else
+            append(batch, "Warning: " + message + "\n");
+    }
+
+    QByteArray text;
+    while(p->queue.pop(text))
+        append(batch, text);
+
+    // The senders fill the queue again while the batch is written
+    if(p->blocked.loadAcquire())
+    {
+        p->spaceMutex.lock();
+        p->spaceCondition.wakeAll();
+        p->spaceMutex.unlock();
+    }
+
+    write(batch);
+}
+
+void AsemanQtLogger::append(QByteArray &batch, const QByteArray &item)
+{
+    const bool binary = (p->openedFormat.load() == BinaryFormat);
+    const qint64 content = p->fileSize + batch.size();
+    if(p->file->isOpen() && content > (binary? ASEMAN_LOG_HEADER_SIZE : 0))
+    {
+        const bool sizeLimit = p->maxFileSize > 0 && content + item.size() > p->maxFileSize;
+        const bool timeLimit = p->rotationInterval > 0 &&
+                               QDateTime::currentMSecsSinceEpoch() - p->openedAt >= qint64(p->rotationInterval)*1000;
+        if(sizeLimit || timeLimit)
+        {
+            write(batch);
+            batch.clear();
+            rotate();
+        }
+    }
+
+    if(binary)
+    {
+        const char *data = item.constData();
+        QByteArray strings[4];
+        int pos = 21;
+        for(int i=0; i<4; i++)
+        {
+            const int size = static_cast<int>(qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(data+pos)));
+            strings[i] = QByteArray::fromRawData(data+pos+4, size);
+            pos += 4 + size;
+        }
+
+        // Interned strings are defined in the batch before the event using them
+        const quint32 category = intern(batch, strings[0]);
+        const quint32 file = intern(batch, strings[1]);
+        const quint32 function = intern(batch, strings[2]);
+        const QByteArray &message = strings[3];
+
+        uchar head[ASEMAN_LOG_RECORD_HEAD + ASEMAN_LOG_EVENT_FIXED_SIZE];
+        head[0] = ASEMAN_LOG_EVENT_RECORD;
+        qToLittleEndian<quint32>(ASEMAN_LOG_EVENT_FIXED_SIZE + message.size(), head+1);
+        memcpy(head+5, data, 17);
+        qToLittleEndian<quint32>(category, head+22);
+        qToLittleEndian<quint32>(file, head+26);
+        memcpy(head+30, data+17, 4);
+        qToLittleEndian<quint32>(function, head+34);
+
+        batch.append(reinterpret_cast<const char*>(head), sizeof(head));
+        batch.append(message);
+    }
+    else
+        batch += item;
+
+    if(batch.size() < LOGGER_BATCH_SIZE)
+        return;
+
+    write(batch);
+    batch.clear();
+}
+
+quint32 AsemanQtLogger::intern(QByteArray &batch, const QByteArray &text)
+{
+    QHash<QByteArray, quint32>::const_iterator i = p->strings.constFind(text);
+    if(i != p->strings.constEnd())
+        return i.value();
+
+    const quint32 id = static_cast<quint32>(p->strings.count());
+    p->strings.insert(QByteArray(text.constData(), text.size()), id);
+
+    uchar head[ASEMAN_LOG_RECORD_HEAD + 4];
+    head[0] = ASEMAN_LOG_STRING_RECORD;
+    qToLittleEndian<quint32>(4 + text.size(), head+1);
+    qToLittleEndian<quint32>(id, head+5);
+
+    batch.append(reinterpret_cast<const char*>(head), sizeof(head));
+    batch.append(text);
+    return id;
+}
+
+void AsemanQtLogger::write(const QByteArray &data)
+{
+    // Silent, a Qt warning here would come back to the queue and keep the writer busy
+    if(data.isEmpty() || !p->file || !p->file->isOpen())
+        return;
+
+    p->file->write(data);
+    p->file->flush();
+    p->fileSize += data.size();
+}
+
+void AsemanQtLogger::rotate()
+{
+    p->file->close();
+    if(p->maxFiles > 0)
+    {
+        QFile::remove(p->path + "." + QString::number(p->maxFiles));
+        for(int i=p->maxFiles-1; i>=1; i--)
+            QFile::rename(p->path + "." + QString::number(i), p->path + "." + QString::number(i+1));
+        QFile::rename(p->path, p->path + ".1");
+    }
+
+    open();
+}
+
+void AsemanQtLogger::open()
+{
+    p->fileSize = 0;
+    p->openedAt = QDateTime::currentMSecsSinceEpoch();
+    p->strings.clear();
+
+    // A failed open is tried again by drain() after LOGGER_REOPEN_INTERVAL
+    if(!p->file->open(QFile::WriteOnly) || p->openedFormat.load() != BinaryFormat)
+        return;
+
+    // Every file stands alone, with its own header and strings
+    uchar header[ASEMAN_LOG_HEADER_SIZE];
+    memcpy(header, ASEMAN_LOG_MAGIC, ASEMAN_LOG_MAGIC_SIZE);
+    qToLittleEndian<quint32>(ASEMAN_LOG_VERSION, header + ASEMAN_LOG_MAGIC_SIZE);
+    write(QByteArray(reinterpret_cast<const char*>(header), ASEMAN_LOG_HEADER_SIZE));
+}
+
 void AsemanQtLogger::app_closed()
 {
 }
 
 AsemanQtLogger::~AsemanQtLogger()
 {
+    aseman_qt_logger_objs_lock.lockForWrite();
     aseman_qt_logger_objs.remove(this);
     if( aseman_qt_logger_objs.isEmpty() )
-        qInstallMessageHandler(0);
+    {
+        qInstallMessageHandler(aseman_qt_logger_previousHandler);
+        aseman_qt_logger_previousHandler = 0;
+    }
+    aseman_qt_logger_objs_lock.unlock();
+
+    // Stops after writing the rest of the queue
+    if(p->writer)
+    {
+        p->writer->stop();
+        delete p->writer;
+    }
+    if(p->file)
+        delete p->file;
 
     delete p;
 }
@@ -28,26 +28,90 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanQtLogger : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QString path READ path NOTIFY pathChanged)
+    Q_PROPERTY(int levels READ levels WRITE setLevels NOTIFY levelsChanged)
+    Q_PROPERTY(int overflowPolicy READ overflowPolicy WRITE setOverflowPolicy NOTIFY overflowPolicyChanged)
+    Q_PROPERTY(qint64 maxFileSize READ maxFileSize WRITE setMaxFileSize NOTIFY maxFileSizeChanged)
+    Q_PROPERTY(int maxFiles READ maxFiles WRITE setMaxFiles NOTIFY maxFilesChanged)
+    Q_PROPERTY(int rotationInterval READ rotationInterval WRITE setRotationInterval NOTIFY rotationIntervalChanged)
+    Q_PROPERTY(int format READ format WRITE setFormat NOTIFY formatChanged)
+    Q_ENUMS(Level)
+    Q_ENUMS(OverflowPolicy)
+    Q_ENUMS(Format)
 
 public:
+    enum Level {
+        DebugLevel = 1,
+        InfoLevel = 2,
+        WarningLevel = 4,
+        CriticalLevel = 8,
+        FatalLevel = 16,
+        AllLevels = 31
+    };
+
+    enum OverflowPolicy {
+        DropMessages,
+        BlockSender
+    };
+
+    enum Format {
+        TextFormat,
+        BinaryFormat
+    };
+
     AsemanQtLogger(const QString & path, QObject *parent = 0);
     virtual ~AsemanQtLogger();
 
     virtual void logMsg(QtMsgType type , const QMessageLogContext &context, const QString &msg);
     QString path() const;
 
+    void setLevels(int levels);
+    int levels() const;
+
+    void setOverflowPolicy(int overflowPolicy);
+    int overflowPolicy() const;
+
+    void setMaxFileSize(qint64 maxFileSize);
+    qint64 maxFileSize() const;
+
+    void setMaxFiles(int maxFiles);
+    int maxFiles() const;
+
+    // In seconds, zero disables it
+    void setRotationInterval(int rotationInterval);
+    int rotationInterval() const;
+
+    // Used by the next start(), read the binary logs using AsemanQtLogReader
+    void setFormat(int format);
+    int format() const;
+
 Q_SIGNALS:
     void pathChanged();
+    void levelsChanged();
+    void overflowPolicyChanged();
+    void maxFileSizeChanged();
+    void maxFilesChanged();
+    void rotationIntervalChanged();
+    void formatChanged();
 
 public Q_SLOTS:
     void debug( const QVariant & var );
     void start();
+    void flush();
 
 private Q_SLOTS:
     void app_closed();
 
+private:
+    void drain();
+    void append(QByteArray &batch, const QByteArray &item);
+    quint32 intern(QByteArray &batch, const QByteArray &text);
+    void write(const QByteArray &data);
+    void rotate();
+    void open();
+
 private:
     AsemanQtLoggerPrivate *p;
+    friend class AsemanQtLoggerWriter;
 };
 
 #endif // ASEMANQTLOGGER_H
@@ -0,0 +1,310 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define LOG_READER_BLOCK_SIZE 1024
+
+#include "asemanqtlogreader.h"
+#include "private/asemanqtlogformat.h"
+
+#include <QFile>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+#include <limits>
+
+/*
+ * The sparse index keeps a block for every LOG_READER_BLOCK_SIZE events,
+ * with their time range and levels. Queries only decode matching blocks.
+ */
+class AsemanQtLogReaderBlock
+{
+public:
+    AsemanQtLogReaderBlock(qint64 offset = 0): offset(offset), minTime(std::numeric_limits<qint64>::max()),
+        maxTime(std::numeric_limits<qint64>::min()), levels(0), count(0) {}
+    qint64 offset;
+    qint64 minTime;
+    qint64 maxTime;
+    int levels;
+    int count;
+};
+
+class AsemanQtLogReaderPrivate
+{
+public:
+    QFile file;
+    const uchar *data;
+    qint64 size;
+    int count;
+    QVector<QString> strings;
+    QVector<AsemanQtLogReaderBlock> blocks;
+
+    QString string(quint32 id) const { return id < static_cast<quint32>(strings.count())? strings.at(id) : QString(); }
+    void read(const AsemanQtLogReaderBlock &block, qint64 from, qint64 to, int levels, int limit, QList<AsemanQtLogRecord> &result) const;
+};
+
+void AsemanQtLogReaderPrivate::read(const AsemanQtLogReaderBlock &block, qint64 from, qint64 to, int levels, int limit, QList<AsemanQtLogRecord> &result) const
+{
+    qint64 pos = block.offset;
+    for(int i=0; i<block.count && pos + ASEMAN_LOG_RECORD_HEAD <= size; )
+    {
+        const uchar *head = data + pos;
+        const quint32 payloadSize = qFromLittleEndian<quint32>(head+1);
+        pos += ASEMAN_LOG_RECORD_HEAD + payloadSize;
+        if(head[0] != ASEMAN_LOG_EVENT_RECORD || payloadSize < ASEMAN_LOG_EVENT_FIXED_SIZE)
+            continue;
+
+        i++;
+        const uchar *payload = head + ASEMAN_LOG_RECORD_HEAD;
+        const qint64 msecs = qFromLittleEndian<qint64>(payload);
+        const int level = payload[8];
+        if(msecs < from || msecs > to || !(level & levels))
+            continue;
+
+        AsemanQtLogRecord record;
+        record.time = QDateTime::fromMSecsSinceEpoch(msecs);
+        record.level = level;
+        record.threadId = qFromLittleEndian<quint64>(payload+9);
+        record.category = string(qFromLittleEndian<quint32>(payload+17));
+        record.file = string(qFromLittleEndian<quint32>(payload+21));
+        record.line = static_cast<int>(qFromLittleEndian<quint32>(payload+25));
+        record.function = string(qFromLittleEndian<quint32>(payload+29));
+        record.message = QString::fromUtf8(reinterpret_cast<const char*>(payload + ASEMAN_LOG_EVENT_FIXED_SIZE),
+                                           static_cast<int>(payloadSize - ASEMAN_LOG_EVENT_FIXED_SIZE));
+
+        result << record;
+        if(limit >= 0 && result.count() >= limit)
+            return;
+    }
+}
+
+AsemanQtLogReader::AsemanQtLogReader(const QString &path)
+{
+    p = new AsemanQtLogReaderPrivate;
+    p->data = 0;
+    p->size = 0;
+    p->count = 0;
+
+    if(!path.isEmpty())
+        open(path);
+}
+
+bool AsemanQtLogReader::open(const QString &path)
+{
+    close();
+
+    p->file.setFileName(path);
+    if(!p->file.open(QFile::ReadOnly))
+        return false;
+
+    p->size = p->file.size();
+    if(p->size >= ASEMAN_LOG_HEADER_SIZE)
+        p->data = p->file.map(0, p->size);
+
+    if(!p->data || memcmp(p->data, ASEMAN_LOG_MAGIC, ASEMAN_LOG_MAGIC_SIZE) != 0 ||
+       qFromLittleEndian<quint32>(p->data + ASEMAN_LOG_MAGIC_SIZE) > ASEMAN_LOG_VERSION)
+    {
+        close();
+        return false;
+    }
+
+    buildIndex();
+    return true;
+}
+
+void AsemanQtLogReader::close()
+{
+    if(p->data)
+        p->file.unmap(const_cast<uchar*>(p->data));
+    if(p->file.isOpen())
+        p->file.close();
+
+    p->data = 0;
+    p->size = 0;
+    p->count = 0;
+    p->strings.clear();
+    p->blocks.clear();
+}
+
+bool AsemanQtLogReader::isOpen() const
+{
+    return p->file.isOpen();
+}
+
+int AsemanQtLogReader::count() const
+{
+    return p->count;
+}
+
+QDateTime AsemanQtLogReader::firstTime() const
+{
+    qint64 result = std::numeric_limits<qint64>::max();
+    for(const AsemanQtLogReaderBlock &block: p->blocks)
+        result = qMin(result, block.minTime);
+
+    return p->count? QDateTime::fromMSecsSinceEpoch(result) : QDateTime();
+}
+
+QDateTime AsemanQtLogReader::lastTime() const
+{
+    qint64 result = std::numeric_limits<qint64>::min();
+    for(const AsemanQtLogReaderBlock &block: p->blocks)
+        result = qMax(result, block.maxTime);
+
+    return p->count? QDateTime::fromMSecsSinceEpoch(result) : QDateTime();
+}
+
+QList<AsemanQtLogRecord> AsemanQtLogReader::find(const QDateTime &from, const QDateTime &to, int levels, int limit) const
+{
+    const qint64 fromTime = from.isValid()? from.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min();
+    const qint64 toTime = to.isValid()? to.toMSecsSinceEpoch() : std::numeric_limits<qint64>::max();
+
+    QList<AsemanQtLogRecord> result;
+    for(const AsemanQtLogReaderBlock &block: p->blocks)
+    {
+        if(block.maxTime < fromTime || block.minTime > toTime || !(block.levels & levels))
+            continue;
+
+        p->read(block, fromTime, toTime, levels, limit, result);
+        if(limit >= 0 && result.count() >= limit)
+            break;
+    }
+
+    return result;
+}
+
+QString AsemanQtLogReader::toText(const AsemanQtLogRecord &record)
+{
+    QString type;
+    switch(record.level)
+    {
+    case AsemanQtLogger::DebugLevel:
+        type = "Debug";
+        break;
+    case AsemanQtLogger::InfoLevel:
+        type = "Info";
+        break;
+    case AsemanQtLogger::WarningLevel:
+        type = "Warning";
+        break;
+    case AsemanQtLogger::CriticalLevel:
+        type = "Critical";
+        break;
+    case AsemanQtLogger::FatalLevel:
+        type = "Fatal";
+        break;
+    }
+
+    if(!record.category.isEmpty() && record.category != "default")
+        type += " [" + record.category + "]";
+
+    // Same layout as the text logs, with the full date and milliseconds
+    return type + ": (" + record.file + ":" + QString::number(record.line) + ", " + record.function + ") " +
+           record.time.toString("yyyy-MM-dd HH:mm:ss.zzz") + " : " + record.message + "\n";
+}
+
+bool AsemanQtLogReader::convertToText(const QString &path, const QString &destination)
+{
+    AsemanQtLogReader reader;
+    if(!reader.open(path))
+        return false;
+
+    QFile file(destination);
+    if(!file.open(QFile::WriteOnly))
+        return false;
+
+    // Block by block, so the whole log is never decoded at once
+    QList<AsemanQtLogRecord> records;
+    for(const AsemanQtLogReaderBlock &block: reader.p->blocks)
+    {
+        records.clear();
+        reader.p->read(block, std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::max(), AsemanQtLogger::AllLevels, -1, records);
+
+        QByteArray text;
+        for(const AsemanQtLogRecord &record: records)
+            text += toText(record).toUtf8();
+
+        if(file.write(text) != text.size())
+            return false;
+    }
+
+    return true;
+}
+
+void AsemanQtLogReader::buildIndex()
+{
+    AsemanQtLogReaderBlock block(ASEMAN_LOG_HEADER_SIZE);
+    qint64 pos = ASEMAN_LOG_HEADER_SIZE;
+    while(pos + ASEMAN_LOG_RECORD_HEAD <= p->size)
+    {
+        const uchar *head = p->data + pos;
+        const quint32 payloadSize = qFromLittleEndian<quint32>(head+1);
+        if(pos + ASEMAN_LOG_RECORD_HEAD + payloadSize > p->size)
+            break; // Cut by a crash while writing
+
+        const uchar *payload = head + ASEMAN_LOG_RECORD_HEAD;
+        switch(head[0])
+        {
+        case ASEMAN_LOG_STRING_RECORD:
+            if(payloadSize >= 4)
+            {
+                // Ids are given in order from 0, a larger one is corrupt and skipped
+                const quint32 id = qFromLittleEndian<quint32>(payload);
+                const QString &text = QString::fromUtf8(reinterpret_cast<const char*>(payload+4), static_cast<int>(payloadSize-4));
+                if(id == static_cast<quint32>(p->strings.count()))
+                    p->strings << text;
+                else
+                if(id < static_cast<quint32>(p->strings.count()))
+                    p->strings[id] = text;
+            }
+            break;
+
+        case ASEMAN_LOG_EVENT_RECORD:
+            if(payloadSize >= ASEMAN_LOG_EVENT_FIXED_SIZE)
+            {
+                if(block.count == LOG_READER_BLOCK_SIZE)
+                {
+                    p->blocks << block;
+                    block = AsemanQtLogReaderBlock(pos);
+                }
+
+                const qint64 msecs = qFromLittleEndian<qint64>(payload);
+                block.minTime = qMin(block.minTime, msecs);
+                block.maxTime = qMax(block.maxTime, msecs);
+                block.levels |= payload[8];
+                block.count++;
+                p->count++;
+            }
+            break;
+        }
+
+        pos += ASEMAN_LOG_RECORD_HEAD + payloadSize;
+    }
+
+    if(block.count)
+        p->blocks << block;
+
+    // The rest may be a record cut by a crash, it's never read
+    p->size = pos;
+}
+
+AsemanQtLogReader::~AsemanQtLogReader()
+{
+    close();
+    delete p;
+}
@@ -0,0 +1,73 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANQTLOGREADER_H
+#define ASEMANQTLOGREADER_H
+
+#include <QDateTime>
+#include <QList>
+#include <QString>
+
+#include "asemanqtlogger.h"
+#include "asemantools_global.h"
+
+class AsemanQtLogRecord
+{
+public:
+    AsemanQtLogRecord(): level(0), threadId(0), line(0) {}
+    QDateTime time;
+    int level;
+    quint64 threadId;
+    QString category;
+    QString file;
+    int line;
+    QString function;
+    QString message;
+};
+
+class AsemanQtLogReaderPrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanQtLogReader
+{
+public:
+    AsemanQtLogReader(const QString &path = QString());
+    virtual ~AsemanQtLogReader();
+
+    // Maps a binary log of AsemanQtLogger and indexes it in one pass
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+
+    int count() const;
+    QDateTime firstTime() const;
+    QDateTime lastTime() const;
+
+    // Invalid times leave that side of the range open
+    QList<AsemanQtLogRecord> find(const QDateTime &from, const QDateTime &to,
+                                  int levels = AsemanQtLogger::AllLevels, int limit = -1) const;
+
+    static QString toText(const AsemanQtLogRecord &record);
+    static bool convertToText(const QString &path, const QString &destination);
+
+private:
+    void buildIndex();
+
+private:
+    AsemanQtLogReaderPrivate *p;
+};
+
+#endif // ASEMANQTLOGREADER_H
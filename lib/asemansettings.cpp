@@ -23,23 +23,145 @@
 #include <QMetaObject>
 #include <QMetaProperty>
 #include <QDir>
-#include <QSettings>
+#include <QScopedPointer>
 #include <QFileInfo>
 #include <QDebug>
+#include <QTimer>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QGuiApplication>
+#include <QSharedPointer>
+
+class AsemanSettingsPendingValue
+{
+public:
+    AsemanSettingsPendingValue(): remove(false) {}
+    QVariant value;
+    bool remove;
+};
+
+typedef QHash<QString, AsemanSettingsPendingValue> AsemanSettingsPendingHash;
+
+class AsemanSettingsBatch
+{
+public:
+    AsemanSettingsPendingHash values;
+    QAtomicInt written;
+};
+
+class AsemanSettingsWriterPool : public QThreadPool
+{
+public:
+    // A single thread keeps the batches in the order they are flushed
+    AsemanSettingsWriterPool() { setMaxThreadCount(1); }
+};
+
+Q_GLOBAL_STATIC(AsemanSettingsWriterPool, aseman_settings_writer_pool)
+
+class AsemanSettingsWriter : public QRunnable
+{
+public:
+    AsemanSettingsWriter(const QString &source, int format, const QSharedPointer<AsemanSettingsBatch> &batch): source(source), format(format), batch(batch) {}
+
+    void run()
+    {
+        // Backends of the same file share their state in the process,
+        // so a local object here is safe next to the one of the gui thread.
+        QScopedPointer<AsemanSettingsBackend> settings(AsemanSettingsBackend::create(source, format));
+        QHashIterator<QString, AsemanSettingsPendingValue> i(batch->values);
+        while(i.hasNext())
+        {
+            i.next();
+            if(i.value().remove)
+                settings->remove(i.key());
+            else
+                settings->setValue(i.key(), i.value().value);
+        }
+
+        settings->sync();
+        batch->written.store(1);
+    }
+
+private:
+    QString source;
+    int format;
+    QSharedPointer<AsemanSettingsBatch> batch;
+};
 
 class AsemanSettingsPrivate
 {
 public:
     QHash<QByteArray, QByteArray> signalsProperties;
-    QSettings *settings;
+    AsemanSettingsBackend *settings;
     QString caregory;
     QString source;
+    int format;
+
+    int writeDelay;
+    QTimer *writeTimer;
+    AsemanSettingsPendingHash pending;
+    QList< QSharedPointer<AsemanSettingsBatch> > writing;
+
+    // Unwritten changes, oldest first. They win over the values of the file.
+    QList<const AsemanSettingsPendingHash*> unwritten()
+    {
+        QList<const AsemanSettingsPendingHash*> res;
+        QMutableListIterator< QSharedPointer<AsemanSettingsBatch> > i(writing);
+        while(i.hasNext())
+        {
+            const QSharedPointer<AsemanSettingsBatch> &batch = i.next();
+            if(batch->written.load())
+                i.remove();
+            else
+                res << &batch->values;
+        }
+        res << &pending;
+        return res;
+    }
+
+    // Reads a full key through the unwritten changes, newest first
+    QVariant read(const QString &key, const QVariant &defaultValue = QVariant())
+    {
+        const QList<const AsemanSettingsPendingHash*> &list = unwritten();
+        for(int i=list.count()-1; i>=0; i--)
+        {
+            AsemanSettingsPendingHash::const_iterator j = list.at(i)->constFind(key);
+            if(j != list.at(i)->constEnd())
+                return j->remove? defaultValue : j->value;
+        }
+
+        return settings->value(key, defaultValue);
+    }
+
+    // Blocks until the flushed batches of this object are in the file
+    void waitForWriting()
+    {
+        unwritten();
+        if(!writing.isEmpty())
+            aseman_settings_writer_pool()->waitForDone();
+        writing.clear();
+    }
 };
 
 AsemanSettings::AsemanSettings(QObject *parent) : QObject(parent)
 {
     p = new AsemanSettingsPrivate;
     p->settings = 0;
+    p->format = IniFormat;
+    p->writeDelay = 0;
+
+    p->writeTimer = new QTimer(this);
+    p->writeTimer->setSingleShot(true);
+
+    connect(p->writeTimer, &QTimer::timeout, this, &AsemanSettings::flush);
+
+    QCoreApplication *app = QCoreApplication::instance();
+    if(app)
+        connect(app, &QCoreApplication::aboutToQuit, this, &AsemanSettings::aboutToQuit);
+
+    QGuiApplication *guiApp = qobject_cast<QGuiApplication*>(app);
+    if(guiApp)
+        connect(guiApp, &QGuiApplication::applicationStateChanged, this, &AsemanSettings::applicationStateChanged);
 
     initProperties();
 }
@@ -64,7 +186,39 @@ void AsemanSettings::setSource(const QString &source)
     if(p->source == source)
         return;
 
+    flush();
+    p->waitForWriting();
+
     p->source = source;
+    reload();
+    Q_EMIT sourceChanged();
+}
+
+QString AsemanSettings::source() const
+{
+    return p->source;
+}
+
+void AsemanSettings::setFormat(int format)
+{
+    if(p->format == format)
+        return;
+
+    flush();
+    p->waitForWriting();
+
+    p->format = format;
+    reload();
+    Q_EMIT formatChanged();
+}
+
+int AsemanSettings::format() const
+{
+    return p->format;
+}
+
+void AsemanSettings::reload()
+{
     if(p->settings)
         delete p->settings;
 
@@ -72,16 +226,33 @@ void AsemanSettings::setSource(const QString &source)
     if(!p->source.isEmpty())
     {
         QDir().mkpath(QFileInfo(p->source).dir().path());
-        p->settings = new QSettings(p->source, QSettings::IniFormat, this);
+        p->settings = AsemanSettingsBackend::create(p->source, p->format);
         initProperties();
     }
+}
 
-    Q_EMIT sourceChanged();
+void AsemanSettings::setWriteDelay(int writeDelay)
+{
+    if(p->writeDelay == writeDelay)
+        return;
+
+    p->writeDelay = writeDelay;
+    if(p->writeDelay <= 0)
+    {
+        // Direct writes must not be overtaken by an older batch
+        flush();
+        p->waitForWriting();
+    }
+    else
+    if(p->writeTimer->isActive())
+        p->writeTimer->start(p->writeDelay);
+
+    Q_EMIT writeDelayChanged();
 }
 
-QString AsemanSettings::source() const
+int AsemanSettings::writeDelay() const
 {
-    return p->source;
+    return p->writeDelay;
 }
 
 void AsemanSettings::setValue(const QString &key, const QVariant &value)
@@ -89,7 +260,7 @@ void AsemanSettings::setValue(const QString &key, const QVariant &value)
     if(!p->settings)
         return;
 
-    p->settings->setValue(PROPERTY_KEY(key), value);
+    write(PROPERTY_KEY(key), value);
     Q_EMIT valueChanged();
 }
 
@@ -98,14 +269,15 @@ QVariant AsemanSettings::value(const QString &key, const QVariant &defaultValue)
     if(!p->settings)
         return QVariant();
 
-    return p->settings->value(PROPERTY_KEY(key), defaultValue);
+    return p->read(PROPERTY_KEY(key), defaultValue);
 }
 
 void AsemanSettings::remove(const QString &key)
 {
     if(!p->settings)
         return;
-    p->settings->remove(PROPERTY_KEY(key));
+
+    write(PROPERTY_KEY(key), QVariant(), true);
 }
 
 QStringList AsemanSettings::keys() const
@@ -114,12 +286,82 @@ QStringList AsemanSettings::keys() const
     if(!p->settings)
         return result;
 
-    p->settings->beginGroup(p->caregory);
-    result = p->settings->childKeys();
-    p->settings->endGroup();
+    result = p->settings->childKeys(p->caregory);
+
+    const QString &prefix = p->caregory.isEmpty()? QString() : p->caregory + "/";
+    for(const AsemanSettingsPendingHash *unwritten: p->unwritten())
+    {
+        QHashIterator<QString, AsemanSettingsPendingValue> i(*unwritten);
+        while(i.hasNext())
+        {
+            i.next();
+            if(!i.key().startsWith(prefix))
+                continue;
+
+            const QString &key = i.key().mid(prefix.length());
+            if(key.contains("/"))
+                continue;
+
+            if(i.value().remove)
+                result.removeAll(key);
+            else
+            if(!result.contains(key))
+                result << key;
+        }
+    }
+
     return result;
 }
 
+void AsemanSettings::flush()
+{
+    p->writeTimer->stop();
+    if(p->pending.isEmpty() || p->source.isEmpty())
+        return;
+
+    QSharedPointer<AsemanSettingsBatch> batch(new AsemanSettingsBatch);
+    batch->values.swap(p->pending);
+    p->unwritten(); // drops the batches already written
+    p->writing << batch;
+
+    aseman_settings_writer_pool()->start( new AsemanSettingsWriter(p->source, p->format, batch) );
+}
+
+void AsemanSettings::write(const QString &key, const QVariant &value, bool remove)
+{
+    if(p->writeDelay <= 0)
+    {
+        if(remove)
+            p->settings->remove(key);
+        else
+            p->settings->setValue(key, value);
+
+        // QSettings syncs itself later, the binary store only appends a record
+        if(p->format == BinaryFormat)
+            p->settings->sync();
+        return;
+    }
+
+    // Changes are coalesced per key and written together when the window ends
+    AsemanSettingsPendingValue &pending = p->pending[key];
+    pending.value = value;
+    pending.remove = remove;
+    if(!p->writeTimer->isActive())
+        p->writeTimer->start(p->writeDelay);
+}
+
+void AsemanSettings::applicationStateChanged(Qt::ApplicationState state)
+{
+    if(state == Qt::ApplicationSuspended || state == Qt::ApplicationHidden)
+        flush();
+}
+
+void AsemanSettings::aboutToQuit()
+{
+    flush();
+    aseman_settings_writer_pool()->waitForDone();
+}
+
 void AsemanSettings::propertyChanged()
 {
     if(sender() != this)
@@ -133,7 +375,7 @@ void AsemanSettings::propertyChanged()
     const QByteArray &propertyName = p->signalsProperties.value(signalObj.methodSignature());
     const QVariant &value = property(propertyName);
     if(p->settings)
-        p->settings->setValue(PROPERTY_KEY(propertyName), value);
+        write(PROPERTY_KEY(propertyName), value);
 
     Q_EMIT valueChanged();
 }
@@ -144,28 +386,32 @@ void AsemanSettings::initProperties()
         return;
 
     const QMetaObject *meta = metaObject();
+    const QString &prefix = p->caregory + "/";
     for(int i=0; i<meta->propertyCount(); i++)
     {
         QMetaProperty property = meta->property(i);
         const QByteArray &propertyName = property.name();
         const QByteArray &signalSign = property.notifySignal().methodSignature();
-        if(propertyName == "source" || propertyName == "category" || propertyName == "objectName")
+        if(propertyName == "source" || propertyName == "category" || propertyName == "writeDelay" || propertyName == "format" || propertyName == "objectName")
             continue;
 
         p->signalsProperties[signalSign] = propertyName;
-        if(p->settings)
-        {
-            QVariant value = p->settings->value(PROPERTY_KEY(propertyName));
-            if(value != QObject::property(propertyName))
-                setProperty(propertyName, value);
-        }
+
+        // Changes of a category still on the way to the file win, as in value()
+        QVariant value = p->read(prefix + QString::fromLatin1(propertyName));
+        if(value != QObject::property(propertyName))
+            setProperty(propertyName, value);
 
         connect(this, QByteArray::number(QSIGNAL_CODE)+signalSign,
-                this, SLOT(propertyChanged()));
+                this, SLOT(propertyChanged()), Qt::UniqueConnection);
     }
 }
 
 AsemanSettings::~AsemanSettings()
 {
+    flush();
+    if(p->settings)
+        delete p->settings;
+
     delete p;
 }
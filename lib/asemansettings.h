@@ -23,6 +23,7 @@
 #include <QVariant>
 
 #include "asemantools_global.h"
+#include "asemansettingsbackend.h"
 
 class AsemanSettingsPrivate;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanSettings : public QObject
@@ -30,7 +31,16 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanSettings : public QObject
     Q_OBJECT
     Q_PROPERTY(QString category READ category WRITE setCategory NOTIFY categoryChanged)
     Q_PROPERTY(QString source READ source WRITE setSource NOTIFY sourceChanged)
+    Q_PROPERTY(int writeDelay READ writeDelay WRITE setWriteDelay NOTIFY writeDelayChanged)
+    Q_PROPERTY(int format READ format WRITE setFormat NOTIFY formatChanged)
+    Q_ENUMS(Format)
+
 public:
+    enum Format {
+        IniFormat = AsemanSettingsBackend::IniFormat,
+        BinaryFormat = AsemanSettingsBackend::BinaryFormat
+    };
+
     AsemanSettings(QObject *parent = 0);
     virtual ~AsemanSettings();
 
@@ -40,20 +50,35 @@ public:
     void setSource(const QString &source);
     QString source() const;
 
+    void setWriteDelay(int writeDelay);
+    int writeDelay() const;
+
+    void setFormat(int format);
+    int format() const;
+
 public Q_SLOTS:
     void setValue(const QString &key, const QVariant &value);
     QVariant value(const QString &key, const QVariant &defaultValue = QVariant());
     void remove(const QString &key);
     QStringList keys() const;
+    void flush();
 
 Q_SIGNALS:
     void categoryChanged();
     void sourceChanged();
+    void writeDelayChanged();
+    void formatChanged();
     void valueChanged();
 
 private Q_SLOTS:
     void propertyChanged();
     void initProperties();
+    void applicationStateChanged(Qt::ApplicationState state);
+    void aboutToQuit();
+
+private:
+    void reload();
+    void write(const QString &key, const QVariant &value, bool remove = false);
 
 private:
     AsemanSettingsPrivate *p;
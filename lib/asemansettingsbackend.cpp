@@ -0,0 +1,72 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemansettingsbackend.h"
+#include "asemanbinarysettings.h"
+
+#include <QSettings>
+
+class AsemanIniSettingsBackend : public AsemanSettingsBackend
+{
+public:
+    AsemanIniSettingsBackend(const QString &source): settings(source, QSettings::IniFormat) {}
+
+    QVariant value(const QString &key, const QVariant &defaultValue) const
+    {
+        return settings.value(key, defaultValue);
+    }
+
+    void setValue(const QString &key, const QVariant &value)
+    {
+        settings.setValue(key, value);
+    }
+
+    void remove(const QString &key)
+    {
+        settings.remove(key);
+    }
+
+    QStringList childKeys(const QString &group) const
+    {
+        QSettings &s = const_cast<QSettings&>(settings);
+        s.beginGroup(group);
+        const QStringList &result = s.childKeys();
+        s.endGroup();
+        return result;
+    }
+
+    void sync()
+    {
+        settings.sync();
+    }
+
+private:
+    QSettings settings;
+};
+
+AsemanSettingsBackend *AsemanSettingsBackend::create(const QString &source, int format)
+{
+    switch(format)
+    {
+    case BinaryFormat:
+        return new AsemanBinarySettings(source);
+    case IniFormat:
+    default:
+        return new AsemanIniSettingsBackend(source);
+    }
+}
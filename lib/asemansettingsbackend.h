@@ -0,0 +1,52 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANSETTINGSBACKEND_H
+#define ASEMANSETTINGSBACKEND_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include "asemantools_global.h"
+
+/*
+ * Storage of AsemanSettings and AsemanApplication::readSetting().
+ * Backends of the same source share their state inside the process, so
+ * every thread may create its own backend for a source and use it.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanSettingsBackend
+{
+public:
+    enum Format {
+        IniFormat,
+        BinaryFormat
+    };
+
+    virtual ~AsemanSettingsBackend() {}
+
+    virtual QVariant value(const QString &key, const QVariant &defaultValue = QVariant()) const = 0;
+    virtual void setValue(const QString &key, const QVariant &value) = 0;
+    virtual void remove(const QString &key) = 0;
+    virtual QStringList childKeys(const QString &group = QString()) const = 0;
+    virtual void sync() = 0;
+
+    static AsemanSettingsBackend *create(const QString &source, int format = IniFormat);
+};
+
+#endif // ASEMANSETTINGSBACKEND_H
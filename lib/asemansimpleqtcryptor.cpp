@@ -42,14 +42,29 @@
 
 #include <QString>
 #include <QCryptographicHash>
+#include <QMessageAuthenticationCode>
 #include <QtEndian>
 #include <QDate>
 #include <QTime>
+#include <QThread>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QRunnable>
 
 #include <QDebug>
 
+#if defined(__AVX2__) && defined(WITH_SERPENT_FAST_SBOX)
+#define WITH_SERPENT_AVX2
+#include <immintrin.h>
+#endif
+
 
 #define ROUNDS 32
+#define CRYPTO_DEVICE_CHUNK (64*1024)
+#define CRYPTO_DEVICE_HEADER 64
+#define CRYPTO_PARALLEL_BLOCKS 8192
+#define CRYPTO_MESSAGE_VERSION 2
+#define CRYPTO_MESSAGE_HEADER 8
 #define KEYSIZE_RC5 20
 #define KEYSIZE_SERPENT 32
 #define SSIZE_RC5 66
@@ -76,6 +91,86 @@ QByteArray header_SERPENT_32  = QString("SERPENT/32:").toLatin1();
 QByteArray header_CBC  = QString("CBC:PADN::").toLatin1();
 QByteArray header_CFB  = QString("CFB::").toLatin1();
 
+// "ASQC" | version | algorithm | mode | checksum, in clear
+QByteArray header_message  = QString("ASQC").toLatin1();
+// starts the encrypted stream of a tagged message, before the algorithm
+QByteArray header_tagged  = QString("ASQC/2:").toLatin1();
+// HKDF salt and labels of the keys of tagged messages
+QByteArray kdf_salt  = QString("AsemanSimpleQtCryptor").toLatin1();
+QByteArray kdf_label_mac  = QString("ASQC/2 mac").toLatin1();
+QByteArray kdf_label_cipher  = QString("ASQC/2 cipher").toLatin1();
+
+
+/* *** MESSAGE HEADER *** */
+
+static QByteArray message_header(Algorithm a, Mode m, Checksum c) {
+    QByteArray res = header_message;
+    res.append( char(CRYPTO_MESSAGE_VERSION) );
+    switch ( a ) {
+#ifdef WITHRC5
+    case RC5_32_32_20: res.append( char(1) ); break;
+    case RC5_64_32_20: res.append( char(2) ); break;
+#endif
+    case SERPENT_32:   res.append( char(3) ); break;
+    default:           res.append( char(0) ); break;
+    }
+    res.append( char(ModeCBC == m ? 1 : 2) );
+    res.append( char(ChecksumSoft == c ? 1 : 2) );
+    return res;
+}
+
+// Unknown versions and codes are reported as NoAlgorithm/NoMode/NoChecksum
+static bool message_header_read(const QByteArray &data, Algorithm &a, Mode &m, Checksum &c) {
+    if ( data.size() < CRYPTO_MESSAGE_HEADER || !data.startsWith(header_message) ) {
+        return false;
+    }
+    a = NoAlgorithm;
+    m = NoMode;
+    c = NoChecksum;
+    const char *h = data.constData() + header_message.size();
+    if ( CRYPTO_MESSAGE_VERSION != h[0] ) {
+        return true;
+    }
+    switch ( h[1] ) {
+#ifdef WITHRC5
+    case 1: a = RC5_32_32_20; break;
+    case 2: a = RC5_64_32_20; break;
+#endif
+    case 3: a = SERPENT_32; break;
+    }
+    switch ( h[2] ) {
+    case 1: m = ModeCBC; break;
+    case 2: m = ModeCFB; break;
+    }
+    switch ( h[3] ) {
+    case 1: c = ChecksumSoft; break;
+    case 2: c = ChecksumHard; break;
+    }
+    return true;
+}
+
+static QCryptographicHash::Algorithm message_hash(Checksum c) {
+    return ChecksumSoft == c ? QCryptographicHash::Sha1 : QCryptographicHash::Sha256;
+}
+
+static int message_tag_size(Checksum c) {
+    return ChecksumSoft == c ? 20 : 32;
+}
+
+// HKDF-SHA256 (RFC 5869) expand step, for keys of up to 32 bytes
+static QByteArray message_kdf(const QByteArray &prk, const QByteArray &label) {
+    return QMessageAuthenticationCode::hash(label + char(1), prk, QCryptographicHash::Sha256);
+}
+
+// compares in constant time, so the tag can not be guessed byte by byte
+static bool message_tag_equal(const QByteArray &tag, const char *data) {
+    uchar diff = 0;
+    for ( int i = 0 ; i < tag.size() ; i++ ) {
+        diff |= uchar(tag.at(i) ^ data[i]);
+    }
+    return 0 == diff;
+}
+
 
 #ifdef WITH_SERPENT_FAST_SBOX
 inline quint32 serpent_sbox_fast(int sbox, quint32 X);
@@ -114,6 +209,10 @@ QString Info::errorText(Error e) {
         return QString("ErrorChecksumNotImplemented");
     case ErrorAlreadyError:
         return QString("ErrorAlreadyError");
+    case ErrorChecksumMismatch:
+        return QString("ErrorChecksumMismatch");
+    case ErrorChecksumMissing:
+        return QString("ErrorChecksumMissing");
     default:
         return QString("UnknownError");
     }
@@ -270,6 +369,15 @@ void Key::expandKeySerpent() {
     delete[] s;
 }
 
+// tagged messages are encrypted and tagged with keys derived by HKDF,
+// never with the key itself
+void Key::expandKeyMessage() {
+    if ( !keyMac.isEmpty() ) return;
+    const QByteArray prk = QMessageAuthenticationCode::hash(key, kdf_salt, QCryptographicHash::Sha256);
+    keyMessage = QSharedPointer<Key>( new Key(message_kdf(prk, kdf_label_cipher)) );
+    keyMac = message_kdf(prk, kdf_label_mac);
+}
+
 
 /* *** ENCRYPTOR *** */
 
@@ -285,17 +393,39 @@ Encryptor::Encryptor(QSharedPointer<Key> k, Algorithm a, Mode m, Checksum c) {
 #endif
     state = StateReset;
     modex = 0;
+    mac = 0;
 }
 
 Encryptor::~Encryptor() {
     delete modex;
+    delete mac;
 }
 
 Error Encryptor::encrypt(const QByteArray &plain, QByteArray &cipher, bool end) {
     QByteArray tmpIn;
+    QByteArray tmpOut;
+    QSharedPointer<Key> layerKey = key;
     switch ( state ) {
     case StateReset:
 
+        switch ( checksum ) {
+        case NoChecksum:
+            break;
+        case ChecksumSoft:
+        case ChecksumHard:
+            key->expandKeyMessage();
+            layerKey = key->keyMessage;
+            if ( 0 == mac ) mac = new QMessageAuthenticationCode(message_hash(checksum), key->keyMac);
+            mac->reset();
+            tmpOut.append(message_header(algorithm, mode, checksum));
+            tmpIn.append(header_tagged);
+            break;
+        case DetectChecksum:
+        default:
+            state = StateError;
+            return ErrorChecksumNotImplemented;
+        }
+
         switch ( algorithm ) {
 #ifdef WITHRC5
         case RC5_32_32_20:
@@ -320,11 +450,11 @@ Error Encryptor::encrypt(const QByteArray &plain, QByteArray &cipher, bool end)
         switch ( mode ) {
         case ModeCBC:
             tmpIn.append(header_CBC);
-            if ( 0 == modex) modex = new CBC(key,algorithm);
+            if ( 0 == modex) modex = new CBC(layerKey, algorithm);
             break;
         case ModeCFB:
             tmpIn.append(header_CFB);
-            if ( 0 == modex) modex = new CFB(key, algorithm);
+            if ( 0 == modex) modex = new CFB(layerKey, algorithm);
             break;
         case NoMode:
         case DetectMode:
@@ -333,16 +463,17 @@ Error Encryptor::encrypt(const QByteArray &plain, QByteArray &cipher, bool end)
             return ErrorNoMode;
         }
 
-        if ( checksum != NoChecksum ) {
-            state = StateError;
-            return ErrorChecksumNotImplemented;
-        }
-        // switch (checksum) HERE
-
         state = StateOn;
+        // the header is streamed first, so plain is never copied behind it
+        tmpOut.reserve(tmpIn.size() + plain.size() + 16);
+        modex->encrypt(tmpIn.constData(), tmpIn.size(), tmpOut, false);
     case StateOn:
-        tmpIn.append(plain);
-        cipher = modex->encrypt(tmpIn, end);
+        modex->encrypt(plain.constData(), plain.size(), tmpOut, end);
+        if ( mac ) {
+            mac->addData(tmpOut);
+            if ( end ) tmpOut.append(mac->result());
+        }
+        cipher = tmpOut;
         break;
     case StateError:
     default:
@@ -355,6 +486,12 @@ Error Encryptor::encrypt(const QByteArray &plain, QByteArray &cipher, bool end)
     return NoError;
 }
 
+void Encryptor::reset() {
+    state = StateReset;
+    if (modex) modex->reset();
+    if (mac) mac->reset();
+}
+
 
 /* *** DECRYPTOR *** */
 
@@ -365,27 +502,127 @@ Decryptor::Decryptor(QSharedPointer<Key> k, Algorithm a, Mode m) {
     state = StateReset;
     checksum = NoChecksum;
     modex = 0;
+    messageModex = 0;
+    authenticated = false;
+    strict = false;
 }
 
 Decryptor::~Decryptor() {
     delete modex;
+    delete messageModex;
 }
 
 Checksum Decryptor::getChecksumType() {
     return checksum;
 }
 
+void Decryptor::setRequireChecksum(bool required) {
+    strict = required;
+}
+
+bool Decryptor::requireChecksum() {
+    return strict;
+}
+
 Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end) {
+    if ( StateReset == state ) {
+        if ( cipher.startsWith(header_message) ) {
+            authenticated = true;
+            pending.clear();
+            state = StateOn;
+        } else if ( strict ) {
+            plain.clear();
+            state = StateError;
+            return ErrorChecksumMissing;
+        }
+    }
+    if ( !authenticated ) {
+        return decryptLayer(modex, key, algorithm, mode, false, cipher.constData(), cipher.size(), plain, end);
+    }
+
+    // held back until the tag can be checked
+    if ( StateError == state ) {
+        return ErrorAlreadyError;
+    }
+    pending.append(cipher);
+    plain.clear();
+    if ( !end ) {
+        return NoError;
+    }
+
+    QByteArray message;
+    message.swap(pending);
+    authenticated = false;
+    state = StateReset;
+    Error e = decryptMessage(message, plain);
+    if ( NoError != e && !strict ) {
+        // an untagged message whose random IV starts like a header
+        state = StateReset;
+        if ( NoError == decryptLayer(modex, key, algorithm, mode, false, message.constData(), message.size(), plain, true) ) {
+            return NoError;
+        }
+        plain.clear();
+    }
+    if ( NoError != e ) {
+        state = StateError;
+    }
+    return e;
+}
+
+Error Decryptor::decryptMessage(const QByteArray &message, QByteArray &plain) {
+    Algorithm a;
+    Mode m;
+    Checksum c;
+    if ( !message_header_read(message, a, m, c) ) {
+        return ErrorNotEnoughData;
+    }
+    if ( NoAlgorithm == a || NoMode == m || NoChecksum == c ) {
+        return ErrorAlgorithmNotImplemented;
+    }
+    if ( (DetectAlgorithm != algorithm && a != algorithm) || (DetectMode != mode && m != mode) ) {
+        return ErrorInvalidKey;
+    }
+
+    const int size = message.size() - message_tag_size(c);
+    if ( size < CRYPTO_MESSAGE_HEADER ) {
+        return ErrorNotEnoughData;
+    }
+
+    key->expandKeyMessage();
+    QMessageAuthenticationCode tag(message_hash(c), key->keyMac);
+    tag.addData(message.constData(), size);
+    if ( !message_tag_equal(tag.result(), message.constData() + size) ) {
+        return ErrorChecksumMismatch;
+    }
+    checksum = c;
+
+    const char *cipher = message.constData() + CRYPTO_MESSAGE_HEADER;
+    if ( a == algorithm && m == mode ) {
+        return decryptLayer(messageModex, key->keyMessage, a, m, true, cipher, size - CRYPTO_MESSAGE_HEADER, plain, true);
+    }
+
+    // detected parameters may change from message to message
+    LayerMode *layer = 0;
+    Error e = decryptLayer(layer, key->keyMessage, a, m, true, cipher, size - CRYPTO_MESSAGE_HEADER, plain, true);
+    delete layer;
+    return e;
+}
+
+Error Decryptor::decryptLayer(LayerMode *&layer, QSharedPointer<Key> k, Algorithm a, Mode m, bool tagged, const char *cipher, int size, QByteArray &plain, bool end) {
     QByteArray expectHeader;
-    QByteArray remainingFromHeader;
-    QByteArray tmpIn;
     QByteArray tmpOut;
+    int offset = 0;
     int neededForHeader = -1;
     int neededForIv = -1;
+    int headerSize = 0;
+    bool whole = false;
 
     switch ( state ) {
     case StateReset:
-        switch ( algorithm ) {
+        if ( tagged ) {
+            expectHeader.append(header_tagged);
+        }
+        switch ( a ) {
 #ifdef WITHRC5
         case RC5_32_32_20:
             expectHeader.append(header_RC5_32_32_20);
@@ -409,16 +646,16 @@ Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end)
             return ErrorNoAlgorithm;
         }
 
-        switch ( mode ) {
+        switch ( m ) {
         case ModeCBC:
             expectHeader.append(header_CBC);
             neededForHeader = (((neededForIv + expectHeader.size() - 1) / neededForIv) + 1) * neededForIv;
-            if ( 0 == modex) modex = new CBC(key, algorithm);
+            if ( 0 == layer ) layer = new CBC(k, a);
             break;
         case ModeCFB:
             expectHeader.append(header_CFB);
             neededForHeader = neededForIv + expectHeader.size();
-            if ( 0 == modex) modex = new CFB(key, algorithm);
+            if ( 0 == layer ) layer = new CFB(k, a);
             break;
         case NoMode:
         case DetectMode:
@@ -428,37 +665,38 @@ Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end)
         }
 
 
-        if ( cipher.size() < neededForHeader ) {
+        if ( size < neededForHeader ) {
             state = StateError;
             return ErrorNotEnoughData;
         }
 
-        tmpOut = modex->decrypt(cipher.left(neededForHeader), false);
+        // one byte more keeps CBC from holding back a block that only looks
+        // like padding; a short message is all header and has to be unpadded
+        headerSize = (size > neededForHeader) ? neededForHeader + 1 : neededForHeader;
+        whole = end && size == headerSize;
+        layer->decrypt(cipher, headerSize, tmpOut, whole);
 
         if ( tmpOut.startsWith(expectHeader) ) {
-            remainingFromHeader = tmpOut.right(tmpOut.size() - expectHeader.size());
-            tmpOut.clear();
-            tmpIn = cipher.right(cipher.size() - neededForHeader);
+            // what is left from the header block is the start of plain
+            tmpOut.remove(0, expectHeader.size());
+            offset = headerSize;
             state = StateOn;
         } else {
             state = StateError;
-            tmpOut.clear();
             return ErrorInvalidKey;
         }
+        if ( whole ) {
+            break;
+        }
 
     case StateOn:
-        if ( tmpIn.isEmpty() ) {
-            tmpIn = cipher;
-        }
-        tmpOut = modex->decrypt(tmpIn, end);
+        tmpOut.reserve(tmpOut.size() + size - offset);
+        layer->decrypt(cipher + offset, size - offset, tmpOut, end);
         break;
     case StateError:
     default:
         return ErrorAlreadyError;
     }
-    if ( ! remainingFromHeader.isEmpty() ) {
-        tmpOut.prepend(remainingFromHeader);
-    }
     if (end) {
         state = StateReset;
     }
@@ -466,6 +704,14 @@ Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end)
     return NoError;
 }
 
+void Decryptor::reset() {
+    state = StateReset;
+    authenticated = false;
+    pending.clear();
+    if (modex) modex->reset();
+    if (messageModex) messageModex->reset();
+}
+
 
 /* *** DECRYPTOR WIZARD ENTRY *** */
 
@@ -511,13 +757,21 @@ Error DecryptorWizard::decrypt(const QByteArray &cipher, QByteArray &plain, QSha
 #endif
     Mode mList[2] = { ModeCBC, ModeCFB };
     int mL = 2;
+    Algorithm hAlg;
+    Mode hMode;
+    Checksum hCsum;
+    // a message header names the combination to try first; an untagged
+    // message may start like one by chance, so the others are tried next
+    bool tagged = message_header_read(cipher, hAlg, hMode, hCsum) && NoAlgorithm != hAlg && NoMode != hMode;
     int eL = entries.size();
-    int eI, aI, mI;
+    int eI, aI, mI, pass;
     Decryptor *dx;
     Error dxError;
     Error retError = ErrorInvalidKey;
 
+    for (pass=(tagged ? 0 : 1) ; pass<2 ; pass++)
     for (eI=0 ; eI<eL ; eI++) for (aI=0 ; aI<aL ; aI++) for (mI=0 ; mI<mL ; mI++) {
+        if ( tagged && ((aList[aI] == hAlg && mList[mI] == hMode) != (0 == pass)) ) continue;
         if ( (entries.at(eI)->alg != aList[aI]) && (entries.at(eI)->alg != DetectAlgorithm) ) continue;
         if ( (entries.at(eI)->mode != mList[mI]) && (entries.at(eI)->mode != DetectMode) ) continue;
         dx = new Decryptor(entries.at(eI)->key, aList[aI], mList[mI]);
@@ -530,6 +784,7 @@ Error DecryptorWizard::decrypt(const QByteArray &cipher, QByteArray &plain, QSha
             retError = ErrorNotEnoughData;
             break;
         case ErrorInvalidKey:
+        case ErrorChecksumMismatch:
             if ( ErrorNotEnoughData != retError ) {
                 retError = ErrorInvalidKey;
             }
@@ -550,6 +805,175 @@ Error DecryptorWizard::decryptToEnd(const QByteArray &cipher, QByteArray &plain)
 }
 
 
+/* *** CRYPTO DEVICE *** */
+
+CryptoDevice::CryptoDevice(QIODevice *d, QSharedPointer<Key> k, Algorithm a, Mode m, QObject *parent) :
+    QIODevice(parent) {
+    device = d;
+    key = k;
+    algorithm = a;
+    mode = m;
+    encryptor = 0;
+    decryptor = 0;
+    outputpos = 0;
+    started = false;
+    finished = false;
+    err = NoError;
+}
+
+CryptoDevice::~CryptoDevice() {
+    close();
+}
+
+bool CryptoDevice::open(OpenMode m) {
+    if ( !device || isOpen() ) return false;
+    if ( (m & ReadWrite) == ReadWrite || !(m & ReadWrite) ) return false;
+    if ( (m & ReadOnly) && !device->isReadable() ) return false;
+    if ( (m & WriteOnly) && !device->isWritable() ) return false;
+
+    delete encryptor;
+    delete decryptor;
+    encryptor = 0;
+    decryptor = 0;
+    if ( m & WriteOnly ) {
+        encryptor = new Encryptor(key, algorithm, mode, NoChecksum);
+    } else {
+        decryptor = new Decryptor(key, algorithm, mode);
+    }
+
+    input.clear();
+    output.clear();
+    outputpos = 0;
+    started = false;
+    finished = false;
+    err = NoError;
+    return QIODevice::open(m | Unbuffered);
+}
+
+void CryptoDevice::close() {
+    if ( !isOpen() ) return;
+
+    // the last call with end=true writes the padding (CBC) or the header of an empty stream
+    if ( encryptor && err == NoError ) {
+        QByteArray cipher;
+        Error e = encryptor->encrypt(QByteArray(), cipher, true);
+        if ( NoError == e ) {
+            device->write(cipher);
+        } else {
+            setError(e);
+        }
+    }
+
+    QIODevice::close();
+    delete encryptor;
+    delete decryptor;
+    encryptor = 0;
+    decryptor = 0;
+    input.clear();
+    output.clear();
+    outputpos = 0;
+}
+
+bool CryptoDevice::isSequential() const {
+    return true;
+}
+
+bool CryptoDevice::atEnd() const {
+    if ( !isOpen() ) return true;
+    if ( encryptor ) return false;
+    return finished && outputpos >= output.size() && QIODevice::bytesAvailable() == 0;
+}
+
+qint64 CryptoDevice::bytesAvailable() const {
+    qint64 res = output.size() - outputpos + QIODevice::bytesAvailable();
+    if ( decryptor && !finished && device ) {
+        res += input.size() + device->bytesAvailable();
+    }
+    return res;
+}
+
+Error CryptoDevice::error() const {
+    return err;
+}
+
+qint64 CryptoDevice::readData(char *data, qint64 maxSize) {
+    if ( !decryptor ) return -1;
+
+    qint64 res = 0;
+    while ( res < maxSize ) {
+        if ( outputpos >= output.size() ) {
+            if ( finished || !fill() ) break;
+            continue;
+        }
+
+        const int copysize = qMin<qint64>(output.size() - outputpos, maxSize - res);
+        memcpy(data + res, output.constData() + outputpos, copysize);
+        outputpos += copysize;
+        res += copysize;
+    }
+
+    if ( 0 == res && (finished || NoError != err) ) return -1;
+    return res;
+}
+
+/*
+ * Reads at most one chunk of cipher and decrypts it into output.
+ * Returns false if nothing could be done right now.
+ */
+bool CryptoDevice::fill() {
+    if ( NoError != err ) return false;
+
+    output.resize(0);
+    outputpos = 0;
+
+    // the cipher ends where device is atEnd(), so this is meant for files and buffers
+    input.append(device->read(CRYPTO_DEVICE_CHUNK - input.size()));
+    const bool end = device->atEnd();
+
+    // the first call of the decryptor needs the whole header
+    if ( !end && (input.isEmpty() || (!started && input.size() < CRYPTO_DEVICE_HEADER)) ) return false;
+
+    QByteArray plain;
+    Error e = decryptor->decrypt(input, plain, end);
+    input.resize(0);
+    if ( NoError != e ) {
+        setError(e);
+        return false;
+    }
+
+    output = plain;
+    started = true;
+    finished = end;
+    return true;
+}
+
+qint64 CryptoDevice::writeData(const char *data, qint64 maxSize) {
+    if ( !encryptor || NoError != err ) return -1;
+
+    qint64 res = 0;
+    QByteArray cipher;
+    while ( res < maxSize ) {
+        const int copysize = qMin<qint64>(maxSize - res, CRYPTO_DEVICE_CHUNK);
+        Error e = encryptor->encrypt(QByteArray::fromRawData(data + res, copysize), cipher, false);
+        if ( NoError != e ) {
+            setError(e);
+            return res ? res : -1;
+        }
+        if ( device->write(cipher) != cipher.size() ) {
+            setErrorString(device->errorString());
+            return res ? res : -1;
+        }
+        res += copysize;
+    }
+    return res;
+}
+
+void CryptoDevice::setError(Error e) {
+    err = e;
+    setErrorString(Info::errorText(e));
+}
+
+
 /* *** INITIALIZATION VECTOR *** */
 
 QByteArray InitializationVector::getVector8() {
@@ -580,6 +1004,94 @@ void InitializationVector::initiate() {
     qsrand((quint32)(QTime::currentTime().msecsTo(QTime(23,59,59,999))));
 }
 
+/* *** LAYER MODE *** */
+
+void LayerMode::encrypt(const char *plain, int size, QByteArray &out, bool end) {
+    out.append(encrypt(QByteArray(plain, size), end));
+}
+
+void LayerMode::decrypt(const char *cipher, int size, QByteArray &out, bool end) {
+    out.append(decrypt(QByteArray(cipher, size), end));
+}
+
+
+/* *** BLOCK BATCHES *** */
+
+/*
+ * Runs count independent blocks through the block layer. Large batches
+ * are split over the global thread pool; ranges that can not start right
+ * away are done on the calling thread, so a busy pool never blocks this.
+ */
+static void cipher_blocks_range(Algorithm a, bool dec, const Key *key, const uchar *in, uchar *out, int count) {
+    switch (a) {
+#ifdef WITHRC5
+    case RC5_32_32_20:
+        if (dec) rc5_32_decrypt_blocks(in, out, count, key->s32);
+        else     rc5_32_encrypt_blocks(in, out, count, key->s32);
+        break;
+    case RC5_64_32_20:
+        if (dec) rc5_64_decrypt_blocks(in, out, count, key->s64);
+        else     rc5_64_encrypt_blocks(in, out, count, key->s64);
+        break;
+#endif
+    case SERPENT_32:
+        if (dec) serpent_decrypt_blocks(in, out, count, key->serpent);
+        else     serpent_encrypt_blocks(in, out, count, key->serpent);
+        break;
+    default:
+        break;
+    }
+}
+
+class CipherBlocksTask : public QRunnable {
+public:
+    CipherBlocksTask(QSemaphore *done, Algorithm a, bool dec, const Key *key, const uchar *in, uchar *out, int count) :
+        done(done), a(a), dec(dec), key(key), in(in), out(out), count(count) {}
+    void run() {
+        cipher_blocks_range(a, dec, key, in, out, count);
+        done->release();
+    }
+private:
+    QSemaphore *done;
+    Algorithm a;
+    bool dec;
+    const Key *key;
+    const uchar *in;
+    uchar *out;
+    int count;
+};
+
+static void cipher_blocks(Algorithm a, bool dec, const Key *key, const uchar *in, uchar *out, int count) {
+#ifdef WITHRC5
+    const int blocksize = (a == RC5_32_32_20) ? 8 : 16;
+#else
+    const int blocksize = 16;
+#endif
+    const int tasks = qMin( QThread::idealThreadCount() , count / CRYPTO_PARALLEL_BLOCKS );
+    if ( tasks < 2 ) {
+        cipher_blocks_range(a, dec, key, in, out, count);
+        return;
+    }
+
+    QSemaphore done;
+    int started = 0;
+    const int per = count / tasks;
+    for ( int t = 1 ; t < tasks ; t++ ) {
+        const int from = t * per;
+        const int size = (t == tasks-1) ? count - from : per;
+        CipherBlocksTask *task = new CipherBlocksTask(&done, a, dec, key, in + from*blocksize, out + from*blocksize, size);
+        if ( QThreadPool::globalInstance()->tryStart(task) ) {
+            started++;
+        } else {
+            delete task;
+            cipher_blocks_range(a, dec, key, in + from*blocksize, out + from*blocksize, size);
+        }
+    }
+    cipher_blocks_range(a, dec, key, in, out, per);
+    done.acquire(started);
+}
+
+
 /* *** CBC *** */
 
 CBC::CBC(QSharedPointer<Key> k, Algorithm a) {
@@ -812,90 +1324,26 @@ QByteArray CBC::decrypt(const QByteArray cipher, bool end) {
     switch (algorithm) {
 #ifdef WITHRC5
     case RC5_32_32_20:
-        {
-            quint32 cbc1 = qFromLittleEndian<quint32>(cbcdat);
-            quint32 cbc2 = qFromLittleEndian<quint32>(cbcdat + 4);
-            quint32 buf1;
-            quint32 buf2;
-            quint32 pln1;
-            quint32 pln2;
-            while ( plainpos < plainlen ) {
-                pln1 = buf1 = qFromLittleEndian<quint32>(bufdat + bufferpos);
-                pln2 = buf2 = qFromLittleEndian<quint32>(bufdat + bufferpos + 4);
-                rc5_32_decrypt_2w(pln1,pln2,key->s32);
-                qToLittleEndian( (pln1 ^ cbc1) , plndat + plainpos);
-                qToLittleEndian( (pln2 ^ cbc2) , plndat + plainpos + 4);
-                cbc1 = buf1;
-                cbc2 = buf2;
-
-                plainpos += worksize;
-                bufferpos += worksize;
-            }
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 4);
-        }
-        break;
     case RC5_64_32_20:
-        {
-            quint64 cbc1 = qFromLittleEndian<quint64>(cbcdat);
-            quint64 cbc2 = qFromLittleEndian<quint64>(cbcdat + 8);
-            quint64 buf1;
-            quint64 buf2;
-            quint64 pln1;
-            quint64 pln2;
-            while ( plainpos < plainlen ) {
-                pln1 = buf1 = qFromLittleEndian<quint64>(bufdat + bufferpos);
-                pln2 = buf2 = qFromLittleEndian<quint64>(bufdat + bufferpos + 8);
-                rc5_64_decrypt_2w(pln1,pln2,key->s64);
-                qToLittleEndian( (pln1 ^ cbc1) , plndat + plainpos);
-                qToLittleEndian( (pln2 ^ cbc2) , plndat + plainpos + 8);
-                cbc1 = buf1;
-                cbc2 = buf2;
-
-                plainpos += worksize;
-                bufferpos += worksize;
-            }
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 8);
-        }
-        break;
 #endif
     case SERPENT_32:
         {
-            quint32 cbc1 = qFromLittleEndian<quint32>(cbcdat);
-            quint32 cbc2 = qFromLittleEndian<quint32>(cbcdat + 4);
-            quint32 cbc3 = qFromLittleEndian<quint32>(cbcdat + 8);
-            quint32 cbc4 = qFromLittleEndian<quint32>(cbcdat + 12);
-            quint32 buf1;
-            quint32 buf2;
-            quint32 buf3;
-            quint32 buf4;
-            quint32 pln1;
-            quint32 pln2;
-            quint32 pln3;
-            quint32 pln4;
-            while ( plainpos < plainlen ) {
-                pln1 = buf1 = qFromLittleEndian<quint32>(bufdat+bufferpos);
-                pln2 = buf2 = qFromLittleEndian<quint32>(bufdat+bufferpos + 4);
-                pln3 = buf3 = qFromLittleEndian<quint32>(bufdat+bufferpos + 8);
-                pln4 = buf4 = qFromLittleEndian<quint32>(bufdat+bufferpos + 12);
-                serpent_decrypt_4w(pln1,pln2,pln3,pln4,key->serpent);
-                qToLittleEndian( (pln1 ^ cbc1) , plndat + plainpos);
-                qToLittleEndian( (pln2 ^ cbc2) , plndat + plainpos + 4);
-                qToLittleEndian( (pln3 ^ cbc3) , plndat + plainpos + 8);
-                qToLittleEndian( (pln4 ^ cbc4) , plndat + plainpos + 12);
-                cbc1 = buf1;
-                cbc2 = buf2;
-                cbc3 = buf3;
-                cbc4 = buf4;
-
+            // blocks do not depend on each other in CBC decrypt, so they
+            // are decrypted in one batch and chained afterwards
+            const int blocks = (plainlen - plainpos) / worksize;
+            if ( 0 == blocks ) break;
+            cipher_blocks(algorithm, true, key.data(), bufdat + bufferpos, plndat + plainpos, blocks);
+
+            const uchar *prev = cbcdat;
+            for ( int i = 0 ; i < blocks ; i++ ) {
+                for ( int j = 0 ; j < worksize ; j++ ) {
+                    plndat[plainpos + j] ^= prev[j];
+                }
+                prev = bufdat + bufferpos;
                 plainpos += worksize;
                 bufferpos += worksize;
             }
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 4);
-            qToLittleEndian(cbc3, cbcdat + 8);
-            qToLittleEndian(cbc4, cbcdat + 12);
+            memcpy(cbcdat, prev, worksize);
         }
         break;
     default:
@@ -977,12 +1425,17 @@ void CFB::reset() {
  *
  */
 QByteArray CFB::encrypt(const QByteArray plain, bool end) {
+    QByteArray cipher;
+    encrypt(plain.constData(), plain.size(), cipher, end);
+    return cipher;
+}
+
+void CFB::encrypt(const char *plain, int plainlen, QByteArray &out, bool end) {
     int plainpos = 0;
-    int plainlen = plain.size();
-    int cipherpos = 0;
+    const int start = out.size();
+    int cipherpos = start;
     int bufferlen = buffer.size();
     int copysize = 0;
-    QByteArray cipher(plainlen, 0);
     uchar *bufdat = 0;
 
     // set initialization vector if first data
@@ -1007,17 +1460,21 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
             break;
         default:
             buffer.clear();
-            return QByteArray();
+            return;
         }
-        cipher.prepend(buffer);
+        // the IV is written in front of the output, no prepend afterward
+        out.resize(start + bufferlen + plainlen);
+        memcpy(out.data() + start, buffer.constData(), bufferlen);
         bufferpos = bufferlen;
         cipherpos += bufferlen;
+    } else {
+        out.resize(start + plainlen);
     }
 
     bufdat = (uchar *)(buffer.data());
 
-    uchar *cphdat = (uchar *)cipher.data();
-    uchar *plndat = (uchar *)plain.data();
+    uchar *cphdat = (uchar *)out.data();
+    const uchar *plndat = (const uchar *)plain;
 
     copysize = qMin( bufferlen - bufferpos , plainlen - plainpos );
     // in case the buffer contains unused data from last encrypt,
@@ -1085,10 +1542,10 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
 #endif
         case SERPENT_32:
             {
-            quint32 B1 = qFromLittleEndian<quint64>(bufdat);
-            quint32 B2 = qFromLittleEndian<quint64>(bufdat + 4);
-            quint32 B3 = qFromLittleEndian<quint64>(bufdat + 8);
-            quint32 B4 = qFromLittleEndian<quint64>(bufdat + 12);
+            quint32 B1 = qFromLittleEndian<quint32>(bufdat);
+            quint32 B2 = qFromLittleEndian<quint32>(bufdat + 4);
+            quint32 B3 = qFromLittleEndian<quint32>(bufdat + 8);
+            quint32 B4 = qFromLittleEndian<quint32>(bufdat + 12);
             quint32 P1 = 0;
             quint32 P2 = 0;
             quint32 P3 = 0;
@@ -1119,8 +1576,8 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
             }
             break;
         default:
-            cipher.clear();
-            return cipher;
+            out.resize(start);
+            return;
         }
         bufferpos = bufferlen;
     }
@@ -1161,8 +1618,8 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
             }
             break;
         default:
-            cipher.clear();
-            return cipher;
+            out.resize(start);
+            return;
         }
         bufferpos = 0;
 
@@ -1179,7 +1636,6 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
     if (end) {
         reset();
     }
-    return cipher;
 }
 
 
@@ -1201,13 +1657,19 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
  *
  */
 QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
+    QByteArray plain;
+    decrypt(cipher.constData(), cipher.size(), plain, end);
+    return plain;
+}
+
+void CFB::decrypt(const char *cipher, int cipherlen, QByteArray &out, bool end) {
     int cipherpos = 0;
-    int cipherlen = cipher.size();
     int bufferlen = -1;
     int copysize = 0;
-    int plainpos = 0;
+    const int start = out.size();
+    int plainpos = start;
     uchar *bufdat = 0;
-    uchar *cphdat = 0;
+    const uchar *cphdat = 0;
     uchar *plndat = 0;
 
     // as long as bufferpos == -1, the initialization vector
@@ -1229,30 +1691,30 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
             bufferlen = 16;
             break;
         default:
-            return QByteArray();
+            return;
         }
         copysize = qMin ( bufferlen - buffer.size() , cipherlen );
-        buffer.append(cipher.left(copysize));
+        buffer.append(cipher, copysize);
         cipherpos = copysize;
         if ( bufferlen == buffer.size() ) {
             bufferpos = bufferlen;
         } else {
-            return QByteArray();
+            return;
         }
     } else {
         bufferlen = buffer.size();
     }
 
-    QByteArray plain(cipherlen - cipherpos, 0);
+    out.resize(start + cipherlen - cipherpos);
 
     bufdat = (uchar *)(buffer.data());
-    cphdat = (uchar *)(cipher.data());
-    plndat = (uchar *)(plain.data());
+    cphdat = (const uchar *)cipher;
+    plndat = (uchar *)(out.data());
 
     copysize = qMin( bufferlen - bufferpos , cipherlen - cipherpos );
     while ( 0 < copysize ) {
-        plndat[plainpos] = buffer[bufferpos] ^ cphdat[cipherpos];
-        buffer[bufferpos] = cphdat[cipherpos];
+        plndat[plainpos] = bufdat[bufferpos] ^ cphdat[cipherpos];
+        bufdat[bufferpos] = cphdat[cipherpos];
         plainpos++;
         cipherpos++;
         bufferpos++;
@@ -1262,102 +1724,23 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
     copysize = qMin( bufferlen , cipherlen - cipherpos );
 
     if ( bufferlen == copysize ) {
-        switch (algorithm) {
-#ifdef WITHRC5
-        case RC5_32_32_20:
-            {
-                quint32 B1 = qFromLittleEndian<quint32>(bufdat);
-                quint32 B2 = qFromLittleEndian<quint32>(bufdat + 4);
-                quint32 C1 = 0;
-                quint32 C2 = 0;
-
-                do {
-                    rc5_32_encrypt_2w(B1,B2,key->s32);
-                    C1 = qFromLittleEndian<quint32>(cphdat + cipherpos);
-                    C2 = qFromLittleEndian<quint32>(cphdat + cipherpos + 4);
-                    B1 ^= C1;
-                    B2 ^= C2;
-                    qToLittleEndian(B1, plndat + plainpos);
-                    qToLittleEndian(B2, plndat + plainpos + 4);
-                    B1 = C1;
-                    B2 = C2;
-                    cipherpos += copysize;
-                    plainpos += copysize;
-                    copysize = qMin( bufferlen , cipherlen - cipherpos );
-                } while ( bufferlen == copysize );
-                qToLittleEndian(B1, bufdat);
-                qToLittleEndian(B2, bufdat + 4);
-            }
-            break;
-        case RC5_64_32_20:
-            {
-                quint64 B1 = qFromLittleEndian<quint64>(bufdat);
-                quint64 B2 = qFromLittleEndian<quint64>(bufdat + 8);
-                quint64 C1 = 0;
-                quint64 C2 = 0;
-
-                do {
-                    rc5_64_encrypt_2w(B1,B2,key->s64);
-                    C1 = qFromLittleEndian<quint64>(cphdat + cipherpos);
-                    C2 = qFromLittleEndian<quint64>(cphdat + cipherpos + 8);
-                    B1 ^= C1;
-                    B2 ^= C2;
-                    qToLittleEndian(B1, plndat + plainpos);
-                    qToLittleEndian(B2, plndat + plainpos + 8);
-                    B1 = C1;
-                    B2 = C2;
-                    cipherpos += copysize;
-                    plainpos += copysize;
-                    copysize = qMin( bufferlen , cipherlen - cipherpos );
-                } while ( bufferlen == copysize );
-                qToLittleEndian(B1, bufdat);
-                qToLittleEndian(B2, bufdat + 8);
-            }
-            break;
-#endif
-        case SERPENT_32:
-            {
-                quint32 B1 = qFromLittleEndian<quint32>(bufdat);
-                quint32 B2 = qFromLittleEndian<quint32>(bufdat + 4);
-                quint32 B3 = qFromLittleEndian<quint32>(bufdat + 8);
-                quint32 B4 = qFromLittleEndian<quint32>(bufdat + 12);
-                quint32 C1 = 0;
-                quint32 C2 = 0;
-                quint32 C3 = 0;
-                quint32 C4 = 0;
-
-                do {
-                    serpent_encrypt_4w(B1,B2,B3,B4,key->serpent);
-                    C1 = qFromLittleEndian<quint32>(cphdat + cipherpos);
-                    C2 = qFromLittleEndian<quint32>(cphdat + cipherpos + 4);
-                    C3 = qFromLittleEndian<quint32>(cphdat + cipherpos + 8);
-                    C4 = qFromLittleEndian<quint32>(cphdat + cipherpos + 12);
-                    B1 ^= C1;
-                    B2 ^= C2;
-                    B3 ^= C3;
-                    B4 ^= C4;
-                    qToLittleEndian(B1, plndat + plainpos);
-                    qToLittleEndian(B2, plndat + plainpos + 4);
-                    qToLittleEndian(B3, plndat + plainpos + 8);
-                    qToLittleEndian(B4, plndat + plainpos + 12);
-                    B1 = C1;
-                    B2 = C2;
-                    B3 = C3;
-                    B4 = C4;
-                    cipherpos += copysize;
-                    plainpos += copysize;
-                    copysize = qMin( bufferlen , cipherlen - cipherpos );
-                } while ( bufferlen == copysize );
-                qToLittleEndian(B1, bufdat);
-                qToLittleEndian(B2, bufdat + 4);
-                qToLittleEndian(B3, bufdat + 8);
-                qToLittleEndian(B4, bufdat + 12);
-            }
-            break;
-        default:
-            plain.clear();
-            return plain;
+        // the keystream of every full block is the encrypted previous
+        // cipher block, so all of them are known and are done in one batch
+        const int blocks = (cipherlen - cipherpos) / bufferlen;
+        uchar *ksdat = plndat + plainpos;
+        memcpy(ksdat, bufdat, bufferlen);
+        memcpy(ksdat + bufferlen, cphdat + cipherpos, (blocks - 1) * bufferlen);
+        cipher_blocks(algorithm, false, key.data(), ksdat, ksdat, blocks);
+
+        const int size = blocks * bufferlen;
+        for ( int i = 0 ; i < size ; i++ ) {
+            ksdat[i] ^= cphdat[cipherpos + i];
         }
+        memcpy(bufdat, cphdat + cipherpos + size - bufferlen, bufferlen);
+
+        cipherpos += size;
+        plainpos += size;
+        copysize = qMin( bufferlen , cipherlen - cipherpos );
         bufferpos = bufferlen;
     }
 
@@ -1397,14 +1780,14 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
             }
             break;
         default:
-            plain.clear();
-            return plain;
+            out.resize(start);
+            return;
         }
         bufferpos = 0;
 
         while ( 0 < copysize ) {
-            plndat[plainpos] = buffer[bufferpos] ^ cphdat[cipherpos];
-            buffer[bufferpos] = cphdat[cipherpos];
+            plndat[plainpos] = bufdat[bufferpos] ^ cphdat[cipherpos];
+            bufdat[bufferpos] = cphdat[cipherpos];
             plainpos++;
             cipherpos++;
             bufferpos++;
@@ -1416,7 +1799,6 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
     if (end) {
         reset();
     }
-    return plain;
 }
 
 
@@ -1531,6 +1913,94 @@ void rc5_64_decrypt_16b(const uchar *cipher16, uchar *plain16, const quint64 *s)
     qToLittleEndian(X2, plain16 + 8);
 }
 
+/*
+ * Multi-block versions. Four blocks are interleaved, so their
+ * independent rounds overlap in the pipeline.
+ */
+void rc5_32_encrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s) {
+    int i = 0;
+    for ( ; i + 4 <= count ; i += 4 ) {
+        quint32 X[4][2];
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            X[b][0] = qFromLittleEndian<quint32>(in + 8*(i+b));
+            X[b][1] = qFromLittleEndian<quint32>(in + 8*(i+b) + 4);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            rc5_32_encrypt_2w(X[b][0], X[b][1], s);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            qToLittleEndian(X[b][0], out + 8*(i+b));
+            qToLittleEndian(X[b][1], out + 8*(i+b) + 4);
+        }
+    }
+    for ( ; i < count ; i++ ) {
+        rc5_32_encrypt_8b(in + 8*i, out + 8*i, s);
+    }
+}
+
+void rc5_32_decrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s) {
+    int i = 0;
+    for ( ; i + 4 <= count ; i += 4 ) {
+        quint32 X[4][2];
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            X[b][0] = qFromLittleEndian<quint32>(in + 8*(i+b));
+            X[b][1] = qFromLittleEndian<quint32>(in + 8*(i+b) + 4);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            rc5_32_decrypt_2w(X[b][0], X[b][1], s);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            qToLittleEndian(X[b][0], out + 8*(i+b));
+            qToLittleEndian(X[b][1], out + 8*(i+b) + 4);
+        }
+    }
+    for ( ; i < count ; i++ ) {
+        rc5_32_decrypt_8b(in + 8*i, out + 8*i, s);
+    }
+}
+
+void rc5_64_encrypt_blocks(const uchar *in, uchar *out, int count, const quint64 *s) {
+    int i = 0;
+    for ( ; i + 4 <= count ; i += 4 ) {
+        quint64 X[4][2];
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            X[b][0] = qFromLittleEndian<quint64>(in + 16*(i+b));
+            X[b][1] = qFromLittleEndian<quint64>(in + 16*(i+b) + 8);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            rc5_64_encrypt_2w(X[b][0], X[b][1], s);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            qToLittleEndian(X[b][0], out + 16*(i+b));
+            qToLittleEndian(X[b][1], out + 16*(i+b) + 8);
+        }
+    }
+    for ( ; i < count ; i++ ) {
+        rc5_64_encrypt_16b(in + 16*i, out + 16*i, s);
+    }
+}
+
+void rc5_64_decrypt_blocks(const uchar *in, uchar *out, int count, const quint64 *s) {
+    int i = 0;
+    for ( ; i + 4 <= count ; i += 4 ) {
+        quint64 X[4][2];
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            X[b][0] = qFromLittleEndian<quint64>(in + 16*(i+b));
+            X[b][1] = qFromLittleEndian<quint64>(in + 16*(i+b) + 8);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            rc5_64_decrypt_2w(X[b][0], X[b][1], s);
+        }
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            qToLittleEndian(X[b][0], out + 16*(i+b));
+            qToLittleEndian(X[b][1], out + 16*(i+b) + 8);
+        }
+    }
+    for ( ; i < count ; i++ ) {
+        rc5_64_decrypt_16b(in + 16*i, out + 16*i, s);
+    }
+}
+
 #endif // WITHRC5
 
 
@@ -1765,6 +2235,230 @@ void serpent_decrypt_16b(const uchar *cipher16, uchar *plain16, const quint32 *s
 }
 
 
+/*
+ * Multi-block Serpent. The portable version runs the rounds of four
+ * blocks side by side; with AVX2 eight blocks are kept in the lanes of
+ * four registers and the sbox tables are read with gathers.
+ */
+static inline void serpent_sbox_4w(int sbox, quint32 &X1, quint32 &X2, quint32 &X3, quint32 &X4) {
+#ifdef WITH_SERPENT_FAST_SBOX
+    X1 = serpent_sbox_fast(sbox, X1);
+    X2 = serpent_sbox_fast(sbox, X2);
+    X3 = serpent_sbox_fast(sbox, X3);
+    X4 = serpent_sbox_fast(sbox, X4);
+#else
+    serpent_sbox_it(sbox, X1, X2, X3, X4);
+#endif
+}
+
+static void serpent_encrypt_4x(const uchar *in, uchar *out, const quint32 *s) {
+    quint32 X[4][4];
+    for ( int b = 0 ; b < 4 ; b++ ) {
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            X[b][w] = qFromLittleEndian<quint32>(in + 16*b + 4*w) ^ s[w];
+        }
+    }
+
+    for ( int round = 0 ; round < ROUNDS ; round++ ) {
+        const int rm8 = round & 0x7;
+        const quint32 *k = s + 4*(round + 1);
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            quint32 &X1 = X[b][0], &X2 = X[b][1], &X3 = X[b][2], &X4 = X[b][3];
+            serpent_sbox_4w(rm8, X1, X2, X3, X4);
+            if ( round < ROUNDS-1 ) {
+                X1 = ROTL32(X1, 13);
+                X3 = ROTL32(X3, 3);
+                X2 = X2 ^ X1 ^ X3;
+                X4 = X4 ^ X3 ^ ( X1 << 3 );
+                X2 = ROTL32(X2, 1);
+                X4 = ROTL32(X4, 7);
+                X1 = X1 ^ X2 ^ X4;
+                X3 = X3 ^ X4 ^ ( X2 << 7 );
+                X1 = ROTL32(X1, 5);
+                X3 = ROTL32(X3, 22);
+            }
+            // the key of the next round, or the final key at the end
+            X1 ^= k[0];
+            X2 ^= k[1];
+            X3 ^= k[2];
+            X4 ^= k[3];
+        }
+    }
+
+    for ( int b = 0 ; b < 4 ; b++ ) {
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            qToLittleEndian(X[b][w], out + 16*b + 4*w);
+        }
+    }
+}
+
+static void serpent_decrypt_4x(const uchar *in, uchar *out, const quint32 *s) {
+    quint32 X[4][4];
+    for ( int b = 0 ; b < 4 ; b++ ) {
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            X[b][w] = qFromLittleEndian<quint32>(in + 16*b + 4*w) ^ s[128 + w];
+        }
+    }
+
+    for ( int round = ROUNDS - 1 ; round >= 0 ; round-- ) {
+        const int rm8 = (round & 0x7) + 8;
+        const quint32 *k = s + 4*round;
+        for ( int b = 0 ; b < 4 ; b++ ) {
+            quint32 &X1 = X[b][0], &X2 = X[b][1], &X3 = X[b][2], &X4 = X[b][3];
+            serpent_sbox_4w(rm8, X1, X2, X3, X4);
+            X1 ^= k[0];
+            X2 ^= k[1];
+            X3 ^= k[2];
+            X4 ^= k[3];
+            if ( round > 0 ) {
+                X3 = ROTR32(X3, 22);
+                X1 = ROTR32(X1, 5);
+                X3 = X3 ^ X4 ^ (X2 << 7);
+                X1 = X1 ^ X2 ^ X4;
+                X4 = ROTR32(X4, 7);
+                X2 = ROTR32(X2, 1);
+                X4 = X4 ^ X3 ^ (X1 << 3);
+                X2 = X2 ^ X1 ^ X3;
+                X3 = ROTR32(X3, 3);
+                X1 = ROTR32(X1, 13);
+            }
+        }
+    }
+
+    for ( int b = 0 ; b < 4 ; b++ ) {
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            qToLittleEndian(X[b][w], out + 16*b + 4*w);
+        }
+    }
+}
+
+#ifdef WITH_SERPENT_AVX2
+#define ROTL32_AVX2(x,y) _mm256_or_si256(_mm256_slli_epi32((x),(y)), _mm256_srli_epi32((x),32-(y)))
+#define ROTR32_AVX2(x,y) _mm256_or_si256(_mm256_srli_epi32((x),(y)), _mm256_slli_epi32((x),32-(y)))
+
+// Same as serpent_sbox_fast() on eight words. The 32bit gathers read one
+// extra entry, the table ends with a padding entry for the last one.
+static inline __m256i serpent_sbox_avx2(int sbox, __m256i X) {
+    const int *table = (const int *)(serpent_sbox_fast_data + sbox * 512);
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const __m256i half = _mm256_set1_epi32(0xffff);
+    const __m256i high = _mm256_set1_epi32(256);
+
+    __m256i lo = _mm256_and_si256(_mm256_i32gather_epi32(table, _mm256_add_epi32(_mm256_and_si256(X, byte), high), 2), half);
+    lo = _mm256_add_epi32(lo, _mm256_and_si256(_mm256_i32gather_epi32(table, _mm256_and_si256(_mm256_srli_epi32(X, 8), byte), 2), half));
+    __m256i hi = _mm256_and_si256(_mm256_i32gather_epi32(table, _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(X, 16), byte), high), 2), half);
+    hi = _mm256_add_epi32(hi, _mm256_and_si256(_mm256_i32gather_epi32(table, _mm256_srli_epi32(X, 24), 2), half));
+
+    // the sums wrap like the quint16 of the scalar version
+    lo = _mm256_and_si256(lo, half);
+    return _mm256_or_si256(lo, _mm256_slli_epi32(hi, 16));
+}
+
+static inline void serpent_load_avx2(const uchar *in, __m256i *X) {
+    const __m256i index = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    for ( int w = 0 ; w < 4 ; w++ ) {
+        X[w] = _mm256_i32gather_epi32((const int *)(in + 4*w), index, 4);
+    }
+}
+
+static inline void serpent_store_avx2(const __m256i *X, uchar *out) {
+    quint32 words[4][8];
+    for ( int w = 0 ; w < 4 ; w++ ) {
+        _mm256_storeu_si256((__m256i *)words[w], X[w]);
+    }
+    for ( int b = 0 ; b < 8 ; b++ ) {
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            qToLittleEndian(words[w][b], out + 16*b + 4*w);
+        }
+    }
+}
+
+static void serpent_encrypt_8x(const uchar *in, uchar *out, const quint32 *s) {
+    __m256i X[4];
+    serpent_load_avx2(in, X);
+    for ( int round = 0 ; round < ROUNDS ; round++ ) {
+        const int rm8 = round & 0x7;
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            X[w] = serpent_sbox_avx2(rm8, _mm256_xor_si256(X[w], _mm256_set1_epi32(s[4*round + w])));
+        }
+        if ( round == ROUNDS-1 ) break;
+
+        X[0] = ROTL32_AVX2(X[0], 13);
+        X[2] = ROTL32_AVX2(X[2], 3);
+        X[1] = _mm256_xor_si256(_mm256_xor_si256(X[1], X[0]), X[2]);
+        X[3] = _mm256_xor_si256(_mm256_xor_si256(X[3], X[2]), _mm256_slli_epi32(X[0], 3));
+        X[1] = ROTL32_AVX2(X[1], 1);
+        X[3] = ROTL32_AVX2(X[3], 7);
+        X[0] = _mm256_xor_si256(_mm256_xor_si256(X[0], X[1]), X[3]);
+        X[2] = _mm256_xor_si256(_mm256_xor_si256(X[2], X[3]), _mm256_slli_epi32(X[1], 7));
+        X[0] = ROTL32_AVX2(X[0], 5);
+        X[2] = ROTL32_AVX2(X[2], 22);
+    }
+    for ( int w = 0 ; w < 4 ; w++ ) {
+        X[w] = _mm256_xor_si256(X[w], _mm256_set1_epi32(s[128 + w]));
+    }
+    serpent_store_avx2(X, out);
+}
+
+static void serpent_decrypt_8x(const uchar *in, uchar *out, const quint32 *s) {
+    __m256i X[4];
+    serpent_load_avx2(in, X);
+    for ( int w = 0 ; w < 4 ; w++ ) {
+        X[w] = _mm256_xor_si256(X[w], _mm256_set1_epi32(s[128 + w]));
+    }
+    for ( int round = ROUNDS - 1 ; round >= 0 ; round-- ) {
+        const int rm8 = (round & 0x7) + 8;
+        for ( int w = 0 ; w < 4 ; w++ ) {
+            X[w] = _mm256_xor_si256(serpent_sbox_avx2(rm8, X[w]), _mm256_set1_epi32(s[4*round + w]));
+        }
+        if ( round == 0 ) break;
+
+        X[2] = ROTR32_AVX2(X[2], 22);
+        X[0] = ROTR32_AVX2(X[0], 5);
+        X[2] = _mm256_xor_si256(_mm256_xor_si256(X[2], X[3]), _mm256_slli_epi32(X[1], 7));
+        X[0] = _mm256_xor_si256(_mm256_xor_si256(X[0], X[1]), X[3]);
+        X[3] = ROTR32_AVX2(X[3], 7);
+        X[1] = ROTR32_AVX2(X[1], 1);
+        X[3] = _mm256_xor_si256(_mm256_xor_si256(X[3], X[2]), _mm256_slli_epi32(X[0], 3));
+        X[1] = _mm256_xor_si256(_mm256_xor_si256(X[1], X[0]), X[2]);
+        X[2] = ROTR32_AVX2(X[2], 3);
+        X[0] = ROTR32_AVX2(X[0], 13);
+    }
+    serpent_store_avx2(X, out);
+}
+#endif // WITH_SERPENT_AVX2
+
+void serpent_encrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s) {
+    int i = 0;
+#ifdef WITH_SERPENT_AVX2
+    for ( ; i + 8 <= count ; i += 8 ) {
+        serpent_encrypt_8x(in + 16*i, out + 16*i, s);
+    }
+#endif
+    for ( ; i + 4 <= count ; i += 4 ) {
+        serpent_encrypt_4x(in + 16*i, out + 16*i, s);
+    }
+    for ( ; i < count ; i++ ) {
+        serpent_encrypt_16b(in + 16*i, out + 16*i, s);
+    }
+}
+
+void serpent_decrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s) {
+    int i = 0;
+#ifdef WITH_SERPENT_AVX2
+    for ( ; i + 8 <= count ; i += 8 ) {
+        serpent_decrypt_8x(in + 16*i, out + 16*i, s);
+    }
+#endif
+    for ( ; i + 4 <= count ; i += 4 ) {
+        serpent_decrypt_4x(in + 16*i, out + 16*i, s);
+    }
+    for ( ; i < count ; i++ ) {
+        serpent_decrypt_16b(in + 16*i, out + 16*i, s);
+    }
+}
+
+
 #ifdef WITH_SERPENT_PRINT_SBOX_H
 void serpent_print_sbox_h() {
     int sbox;
@@ -53,10 +53,12 @@
 #include <QByteArray>
 #include <QSharedPointer>
 #include <QObject>
+#include <QIODevice>
 
 #include "asemantools_global.h"
 
 class QString;
+class QMessageAuthenticationCode;
 
 namespace AsemanSimpleQtCryptor {
 
@@ -84,6 +86,7 @@ enum Mode {
     ModeCFB
 };
 
+// Soft is an HMAC-SHA1 and Hard an HMAC-SHA256 tag over the message
 enum Checksum {
     NoChecksum = 0,
     DetectChecksum,
@@ -101,7 +104,9 @@ enum Error {
     ErrorModeNotImplemented,
     ErrorAlgorithmNotImplemented,
     ErrorChecksumNotImplemented,
-    ErrorAlreadyError
+    ErrorAlreadyError,
+    ErrorChecksumMismatch,
+    ErrorChecksumMissing
 };
 
 
@@ -134,6 +139,7 @@ public:
     void expandKeyRc564();
 #endif
     void expandKeySerpent();
+    void expandKeyMessage();
 
     // variables
     QByteArray key;
@@ -144,6 +150,8 @@ public:
 #endif
     QByteArray keySerpent;
     quint32 *serpent;
+    QByteArray keyMac;
+    QSharedPointer<Key> keyMessage;
 private:
     QByteArray resizeKey(int ks);
 };
@@ -160,6 +168,17 @@ private:
  *  - Call reset() only if you want to start over after an error
  *    (typically ErrorInvalidKey or ErrorNotEnoughData);
  *    as long as you use end=true, you never need to reset().
+ *
+ * About checksums
+ *  - With a checksum the message starts with a clear header naming
+ *    the algorithm and mode, and ends with a tag over all of it.
+ *    Decryptors read such messages whatever they were created with.
+ *  - The tag is checked before anything is decrypted, so a Decryptor
+ *    holds back these messages until the chunk with end=true.
+ *  - Tagged messages are encrypted with a key derived from the given
+ *    one, so the body of a stripped message is not a valid untagged one.
+ *  - setRequireChecksum(true) makes a Decryptor refuse untagged
+ *    messages with ErrorChecksumMissing.
  */
 class Encryptor : public QObject {
     Q_OBJECT
@@ -175,12 +194,14 @@ private:
     Checksum checksum;
     State state;
     LayerMode *modex;
+    QMessageAuthenticationCode *mac;
 };
 
 
 // will attempt all different combinations, and give you a
 // Decryptor back to decrypt rest of data or more messages
-// from the same source
+// from the same source. Messages with a checksum name their
+// algorithm and mode, so only the keys are tried for them.
 class DecryptorWizardEntry;
 class DecryptorWizard {
 public:
@@ -206,13 +227,65 @@ public:
     Error decrypt(const QByteArray &cipher, QByteArray &plain, bool end);
     void reset();
     Checksum getChecksumType();
+    void setRequireChecksum(bool required);
+    bool requireChecksum();
 private:
+    Error decryptMessage(const QByteArray &message, QByteArray &plain);
+    Error decryptLayer(LayerMode *&layer, QSharedPointer<Key> k, Algorithm a, Mode m, bool tagged, const char *cipher, int size, QByteArray &plain, bool end);
+
     QSharedPointer<Key> key;
     Algorithm algorithm;
     Mode mode;
     State state;
     Checksum checksum;
     LayerMode *modex;
+    LayerMode *messageModex;
+    bool authenticated;
+    bool strict;
+    QByteArray pending;
+};
+
+
+
+/*
+ * Encrypts what is written to it into device, or decrypts what is
+ * read from device, in bounded chunks. The device must be opened
+ * by the caller and is not closed with this one. Only ReadOnly or
+ * WriteOnly are supported; the stream is finished on close().
+ */
+class LIBASEMANTOOLSSHARED_EXPORT CryptoDevice : public QIODevice {
+    Q_OBJECT
+public:
+    CryptoDevice(QIODevice *device, QSharedPointer<Key> k, Algorithm a, Mode m, QObject *parent = 0);
+    virtual ~CryptoDevice();
+
+    bool open(OpenMode mode);
+    void close();
+    bool isSequential() const;
+    bool atEnd() const;
+    qint64 bytesAvailable() const;
+    Error error() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    bool fill();
+    void setError(Error e);
+
+    QIODevice *device;
+    QSharedPointer<Key> key;
+    Algorithm algorithm;
+    Mode mode;
+    Encryptor *encryptor;
+    Decryptor *decryptor;
+    QByteArray input;
+    QByteArray output;
+    int outputpos;
+    bool started;
+    bool finished;
+    Error err;
 };
 
 
@@ -236,6 +309,9 @@ class LayerMode {
 public:
     virtual QByteArray encrypt(const QByteArray plain, bool end) = 0;
     virtual QByteArray decrypt(const QByteArray cipher, bool end) = 0;
+    // Append the result to out, modes may override them to avoid copies
+    virtual void encrypt(const char *plain, int size, QByteArray &out, bool end);
+    virtual void decrypt(const char *cipher, int size, QByteArray &out, bool end);
     virtual void reset() = 0;
     virtual ~LayerMode() {};
 };
@@ -246,6 +322,8 @@ public:
     virtual ~CFB();
     QByteArray encrypt(const QByteArray plain, bool end = false);
     QByteArray decrypt(const QByteArray cipher, bool end = false);
+    void encrypt(const char *plain, int size, QByteArray &out, bool end);
+    void decrypt(const char *cipher, int size, QByteArray &out, bool end);
     void reset();
 private:
     QByteArray buffer;
@@ -258,6 +336,8 @@ class CBC : public LayerMode {
 public:
     CBC(QSharedPointer<Key> k, Algorithm a);
     virtual ~CBC();
+    using LayerMode::encrypt;
+    using LayerMode::decrypt;
     QByteArray encrypt(const QByteArray plain, bool end);
     QByteArray decrypt(const QByteArray cipher, bool end);
     void reset();
@@ -284,6 +364,12 @@ void rc5_32_encrypt_8b(const uchar *plain8, uchar *cipher8, const quint32 *s);
 void rc5_64_encrypt_16b(const uchar *plain16, uchar *cipher16, const quint64 *s);
 void rc5_32_decrypt_8b(const uchar *cipher8, uchar *plain8, const quint32 *s);
 void rc5_64_decrypt_16b(const uchar *cipher16, uchar *plain16, const quint64 *s);
+
+// count independent blocks, in and out may be the same buffer
+void rc5_32_encrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s);
+void rc5_32_decrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s);
+void rc5_64_encrypt_blocks(const uchar *in, uchar *out, int count, const quint64 *s);
+void rc5_64_decrypt_blocks(const uchar *in, uchar *out, int count, const quint64 *s);
 #endif
 
 void serpent_encrypt_4w(quint32 &X1, quint32 &X2,
@@ -295,6 +381,10 @@ void serpent_decrypt_4w(quint32 &X1, quint32 &X2,
 void serpent_encrypt_16b(const uchar *plain16, uchar *cipher16, const quint32 *s);
 void serpent_decrypt_16b(const uchar *cipher16, uchar *plain16, const quint32 *s);
 
+// count independent blocks, in and out may be the same buffer
+void serpent_encrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s);
+void serpent_decrypt_blocks(const uchar *in, uchar *out, int count, const quint32 *s);
+
 #ifdef WITH_SERPENT_PRINT_SBOX_H
 void serpent_print_sbox_h();
 #endif
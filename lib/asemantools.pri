@@ -151,6 +151,7 @@ macx {
 SOURCES += \
     $$PWD/asemandevices.cpp \
     $$PWD/asemanqtlogger.cpp \
+    $$PWD/asemanqtlogreader.cpp \
     $$PWD/asemantools.cpp \
     $$PWD/asemandesktoptools.cpp \
     $$PWD/asemanlistobject.cpp \
@@ -173,6 +174,9 @@ SOURCES += \
     $$PWD/asemanquickitemimagegrabber.cpp \
     $$PWD/asemanquickobject.cpp \
     $$PWD/asemanfilesystemmodel.cpp \
+    $$PWD/private/asemanfilesystemmodelcore.cpp \
+    $$PWD/private/asemanimagecolorkernel.cpp \
+    $$PWD/asemannaturalsortkey.cpp \
     $$PWD/asemandebugobjectcounter.cpp \
     $$PWD/asemanfiledownloaderqueue.cpp \
     $$PWD/asemanfiledownloaderqueueitem.cpp \
@@ -186,6 +190,7 @@ SOURCES += \
     $$PWD/asemanqttools.cpp \
     $$PWD/asemancalendarmodel.cpp \
     $$PWD/asemanlistrecord.cpp \
+    $$PWD/asemanlistrecordfile.cpp \
     $$PWD/asemanquickviewwrapper.cpp \
     $$PWD/asemanfonthandler.cpp \
     $$PWD/asemansimpleqtcryptor.cpp \
@@ -204,6 +209,8 @@ SOURCES += \
     $$PWD/asemanstoremanagermodel.cpp \
     $$PWD/asemanwindowdetails.cpp \
     $$PWD/asemansettings.cpp \
+    $$PWD/asemansettingsbackend.cpp \
+    $$PWD/asemanbinarysettings.cpp \
     $$PWD/asemantexttools.cpp \
     $$PWD/asemanapplicationitem.cpp \
     $$PWD/asemanencrypter.cpp \
@@ -219,6 +226,8 @@ SOURCES += \
 HEADERS += \
     $$PWD/asemandevices.h \
     $$PWD/asemanqtlogger.h \
+    $$PWD/asemanqtlogreader.h \
+    $$PWD/private/asemanqtlogformat.h \
     $$PWD/asemantools.h \
     $$PWD/asemandesktoptools.h \
     $$PWD/asemanlistobject.h \
@@ -242,6 +251,9 @@ HEADERS += \
     $$PWD/asemanquickitemimagegrabber.h \
     $$PWD/asemanquickobject.h \
     $$PWD/asemanfilesystemmodel.h \
+    $$PWD/private/asemanfilesystemmodelcore.h \
+    $$PWD/private/asemanimagecolorkernel.h \
+    $$PWD/asemannaturalsortkey.h \
     $$PWD/asemandebugobjectcounter.h \
     $$PWD/asemanfiledownloaderqueue.h \
     $$PWD/asemanfiledownloaderqueueitem.h \
@@ -255,6 +267,7 @@ HEADERS += \
     $$PWD/asemanqttools.h \
     $$PWD/asemancalendarmodel.h \
     $$PWD/asemanlistrecord.h \
+    $$PWD/asemanlistrecordfile.h \
     $$PWD/asemanquickviewwrapper.h \
     $$PWD/asemanfonthandler.h \
     $$PWD/asemansimpleqtcryptor.h \
@@ -275,6 +288,8 @@ HEADERS += \
     $$PWD/asemanglobals.h \
     $$PWD/asemanwindowdetails.h \
     $$PWD/asemansettings.h \
+    $$PWD/asemansettingsbackend.h \
+    $$PWD/asemanbinarysettings.h \
     $$PWD/asemantexttools.h \
     $$PWD/asemanapplicationitem.h \
     $$PWD/asemanencrypter.h \
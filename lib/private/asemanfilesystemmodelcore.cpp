@@ -0,0 +1,209 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define ASEMAN_FILESYSTEM_BATCH_SIZE 128
+
+#include "asemanfilesystemmodelcore.h"
+#include "../asemanfilesystemmodel.h"
+#include "../asemannaturalsortkey.h"
+
+#include <QDir>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QMimeDatabase>
+#include <QMimeType>
+#include <QDebug>
+
+#include <algorithm>
+
+class AsemanFileSystemSortUnit
+{
+public:
+    AsemanFileSystemSortUnit(): isDir(false), value(0) {}
+    AsemanFileSystemSortUnit(const QFileInfo &info, int sortField): info(info), key(info.fileName()), isDir(info.isDir()), value(0)
+    {
+        switch(sortField)
+        {
+        case AsemanFileSystemModel::Size:
+            value = info.size();
+            break;
+        case AsemanFileSystemModel::Date:
+            value = info.lastModified().toMSecsSinceEpoch();
+            break;
+        }
+    }
+
+    QFileInfo info;
+    AsemanNaturalSortKey key;
+    bool isDir;
+    qint64 value;
+};
+
+class AsemanFileListSorter
+{
+public:
+    AsemanFileListSorter(bool showDirsFirst): showDirsFirst(showDirsFirst) {}
+
+    bool operator()(const AsemanFileSystemSortUnit &f1, const AsemanFileSystemSortUnit &f2) const
+    {
+        if(showDirsFirst && f1.isDir != f2.isDir)
+            return f1.isDir;
+        if(f1.value != f2.value)
+            return f1.value < f2.value;
+
+        return f1.key < f2.key;
+    }
+
+    bool showDirsFirst;
+};
+
+QList<QFileInfo> aseman_sorted_file_list(QVector<AsemanFileSystemSortUnit> units, const AsemanFileListSorter &sorter)
+{
+    std::stable_sort(units.begin(), units.end(), sorter);
+
+    QList<QFileInfo> res;
+    res.reserve(units.count());
+    for(const AsemanFileSystemSortUnit &unit: units)
+        res << unit.info;
+
+    return res;
+}
+
+bool aseman_name_filters_matched(const QFileInfo &inf, const QStringList &nameFilters, const QMimeDatabase &mdb)
+{
+    QStringList suffixes;
+    if(!inf.suffix().isEmpty())
+        suffixes << inf.suffix();
+    else
+        suffixes = mdb.mimeTypeForFile(inf.filePath()).suffixes();
+
+    bool founded = inf.isDir();
+    for(const QString &sfx: suffixes)
+        if(nameFilters.contains("*."+sfx, Qt::CaseInsensitive))
+        {
+            founded = true;
+            break;
+        }
+
+    return founded;
+}
+
+
+class AsemanFileSystemModelCorePrivate
+{
+public:
+    QAtomicInt *generation;
+};
+
+AsemanFileSystemModelCore::AsemanFileSystemModelCore(QAtomicInt *generation, QObject *parent) :
+    QObject(parent)
+{
+    p = new AsemanFileSystemModelCorePrivate;
+    p->generation = generation;
+}
+
+QList<QFileInfo> AsemanFileSystemModelCore::scan(const AsemanFileSystemScanOptions &options)
+{
+    QList<QFileInfo> result;
+    scan_prv(options, result, 0, 0);
+    return result;
+}
+
+void AsemanFileSystemModelCore::start(int generation, const AsemanFileSystemScanOptions &options)
+{
+    AsemanFileSystemScanResult result;
+    result.generation = generation;
+    result.finished = true;
+    if(!scan_prv(options, result.list, this, generation))
+        return;
+
+    Q_EMIT listFound(result);
+}
+
+bool AsemanFileSystemModelCore::scan_prv(const AsemanFileSystemScanOptions &options, QList<QFileInfo> &res, AsemanFileSystemModelCore *core, int generation)
+{
+    if(!options.filter || options.folder.isEmpty())
+        return true;
+
+    const AsemanFileListSorter sorter(options.showDirsFirst);
+    QVector<AsemanFileSystemSortUnit> units;
+    QMimeDatabase mdb;
+    int nextPartial = ASEMAN_FILESYSTEM_BATCH_SIZE;
+
+    QDirIterator it(options.folder, static_cast<QDir::Filters>(options.filter));
+    while(it.hasNext())
+    {
+        if(core && core->isCanceled(generation))
+            return false;
+
+        it.next();
+        const QFileInfo inf(options.folder + "/" + it.fileName());
+        if(!options.nameFilters.isEmpty() && !aseman_name_filters_matched(inf, options.nameFilters, mdb))
+            continue;
+
+        // The sort unit fills the cached stats here, so the gui thread only reads them
+        units << AsemanFileSystemSortUnit(inf, options.sortField);
+        if(!core || !options.partial || units.count() < nextPartial)
+            continue;
+
+        // Partial lists grow exponentially to keep the total sort cost near O(n log n)
+        AsemanFileSystemScanResult partial;
+        partial.generation = generation;
+        partial.list = aseman_sorted_file_list(units, sorter);
+        Q_EMIT core->listFound(partial);
+
+        nextPartial *= 2;
+    }
+
+    if(core && core->isCanceled(generation))
+        return false;
+
+    res = aseman_sorted_file_list(units, sorter);
+    return true;
+}
+
+bool AsemanFileSystemModelCore::isCanceled(int generation) const
+{
+    return p->generation->load() != generation;
+}
+
+AsemanFileSystemModelCore::~AsemanFileSystemModelCore()
+{
+    delete p;
+}
+
+
+AsemanFileSystemMimeSniffer::AsemanFileSystemMimeSniffer(const QSharedPointer<AsemanFileSystemModelGuard> &guard, const QString &path, int row) :
+    guard(guard),
+    path(path),
+    row(row)
+{
+}
+
+void AsemanFileSystemMimeSniffer::run()
+{
+    QMimeDatabase mdb;
+    const QString &mime = mdb.mimeTypeForFile(path).name();
+
+    // The model clears the guard under this lock before destroying, so it
+    // is alive while posting. Posted events of deleted objects are dropped.
+    QMutexLocker locker(&guard->mutex);
+    if(guard->model)
+        QMetaObject::invokeMethod(guard->model, "mimeFound", Qt::QueuedConnection,
+                                  Q_ARG(QString, path), Q_ARG(QString, mime), Q_ARG(int, row));
+}
@@ -0,0 +1,101 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANFILESYSTEMMODELCORE_H
+#define ASEMANFILESYSTEMMODELCORE_H
+
+#include <QObject>
+#include <QStringList>
+#include <QFileInfo>
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include "asemantools_global.h"
+
+class AsemanFileSystemScanOptions
+{
+public:
+    AsemanFileSystemScanOptions(): filter(0), showDirsFirst(true), sortField(0), partial(false) {}
+    QString folder;
+    int filter;
+    QStringList nameFilters;
+    bool showDirsFirst;
+    int sortField;
+    bool partial;
+};
+
+class AsemanFileSystemScanResult
+{
+public:
+    AsemanFileSystemScanResult(): generation(0), finished(false) {}
+    int generation;
+    bool finished;
+    QList<QFileInfo> list;
+};
+
+Q_DECLARE_METATYPE(AsemanFileSystemScanOptions)
+Q_DECLARE_METATYPE(AsemanFileSystemScanResult)
+
+class AsemanFileSystemModelCorePrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemModelCore : public QObject
+{
+    Q_OBJECT
+public:
+    AsemanFileSystemModelCore(QAtomicInt *generation, QObject *parent = 0);
+    virtual ~AsemanFileSystemModelCore();
+
+    static QList<QFileInfo> scan(const AsemanFileSystemScanOptions &options);
+
+public Q_SLOTS:
+    void start(int generation, const AsemanFileSystemScanOptions &options);
+
+Q_SIGNALS:
+    void listFound(const AsemanFileSystemScanResult &result);
+
+private:
+    static bool scan_prv(const AsemanFileSystemScanOptions &options, QList<QFileInfo> &result, AsemanFileSystemModelCore *core, int generation);
+    bool isCanceled(int generation) const;
+
+private:
+    AsemanFileSystemModelCorePrivate *p;
+};
+
+
+class AsemanFileSystemModelGuard
+{
+public:
+    AsemanFileSystemModelGuard(QObject *model): model(model) {}
+    QMutex mutex;
+    QObject *model;
+};
+
+class AsemanFileSystemMimeSniffer : public QRunnable
+{
+public:
+    AsemanFileSystemMimeSniffer(const QSharedPointer<AsemanFileSystemModelGuard> &guard, const QString &path, int row);
+    void run();
+
+private:
+    QSharedPointer<AsemanFileSystemModelGuard> guard;
+    QString path;
+    int row;
+};
+
+#endif // ASEMANFILESYSTEMMODELCORE_H
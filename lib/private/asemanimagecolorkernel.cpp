@@ -0,0 +1,420 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemanimagecolorkernel.h"
+#include "../asemanimagecoloranalizor.h"
+
+#include <QVector>
+#include <QVariantMap>
+
+#include <algorithm>
+
+#define PALETTE_BITS 5
+#define PALETTE_SIDE (1 << PALETTE_BITS)
+#define PALETTE_SAMPLES 65536
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ASEMAN_COLOR_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+ * The filters are the integer forms of the old QColor based checks, so the
+ * results are the same:
+ *   Normal:          70 <= (r+g+b)/3 <= 180
+ *   MoreSaturation:  QColor::saturation() >= 150  =>  max*54271 >= min*131070
+ *                    QColor::lightness() >= 50    =>  max+min >= 100
+ */
+
+static inline bool aseman_color_accept(int method, int r, int g, int b)
+{
+    if(method == AsemanImageColorAnalizor::Normal)
+    {
+        const int sum = r + g + b;
+        return sum >= 210 && sum <= 542;
+    }
+
+    const int max = qMax(r, qMax(g, b));
+    const int min = qMin(r, qMin(g, b));
+    return max*54271 >= min*131070 && max+min >= 100;
+}
+
+static inline void aseman_color_row_scalar(int method, const quint32 *line, int from, int width, AsemanImageColorSums &sums)
+{
+    for(int x=from; x<width; x++)
+    {
+        const int r = (line[x] >> 16) & 0xff;
+        const int g = (line[x] >> 8) & 0xff;
+        const int b = line[x] & 0xff;
+        if(!aseman_color_accept(method, r, g, b))
+            continue;
+
+        sums.red += r;
+        sums.green += g;
+        sums.blue += b;
+        sums.count++;
+    }
+}
+
+#if defined(__AVX2__)
+static inline quint64 aseman_color_hsum(__m256i v)
+{
+    const __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    quint32 lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), s);
+    return quint64(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+static inline __m256i aseman_color_mask(int method, __m256i r, __m256i g, __m256i b)
+{
+    if(method == AsemanImageColorAnalizor::Normal)
+    {
+        const __m256i sum = _mm256_add_epi32(_mm256_add_epi32(r, g), b);
+        return _mm256_and_si256(_mm256_cmpgt_epi32(sum, _mm256_set1_epi32(209)),
+                                _mm256_cmpgt_epi32(_mm256_set1_epi32(543), sum));
+    }
+
+    const __m256i max = _mm256_max_epi32(r, _mm256_max_epi32(g, b));
+    const __m256i min = _mm256_min_epi32(r, _mm256_min_epi32(g, b));
+    const __m256i maxProduct = _mm256_mullo_epi32(max, _mm256_set1_epi32(54271));
+    const __m256i minProduct = _mm256_mullo_epi32(min, _mm256_set1_epi32(131070));
+    return _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_add_epi32(maxProduct, _mm256_set1_epi32(1)), minProduct),
+                            _mm256_cmpgt_epi32(_mm256_add_epi32(max, min), _mm256_set1_epi32(99)));
+}
+
+static void aseman_color_row(int method, const quint32 *line, int width, AsemanImageColorSums &sums)
+{
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    __m256i red = _mm256_setzero_si256();
+    __m256i green = _mm256_setzero_si256();
+    __m256i blue = _mm256_setzero_si256();
+    __m256i count = _mm256_setzero_si256();
+
+    // 32bit lanes can't overflow in a single row
+    int x = 0;
+    for(; x+8 <= width; x+=8)
+    {
+        const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line+x));
+        const __m256i r = _mm256_and_si256(_mm256_srli_epi32(px, 16), byteMask);
+        const __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), byteMask);
+        const __m256i b = _mm256_and_si256(px, byteMask);
+        const __m256i mask = aseman_color_mask(method, r, g, b);
+
+        red = _mm256_add_epi32(red, _mm256_and_si256(r, mask));
+        green = _mm256_add_epi32(green, _mm256_and_si256(g, mask));
+        blue = _mm256_add_epi32(blue, _mm256_and_si256(b, mask));
+        count = _mm256_sub_epi32(count, mask);
+    }
+
+    sums.red += aseman_color_hsum(red);
+    sums.green += aseman_color_hsum(green);
+    sums.blue += aseman_color_hsum(blue);
+    sums.count += aseman_color_hsum(count);
+
+    aseman_color_row_scalar(method, line, x, width, sums);
+}
+
+#elif defined(ASEMAN_COLOR_KERNEL_SSE2)
+static inline quint64 aseman_color_hsum(__m128i v)
+{
+    quint32 lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+    return quint64(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+static inline __m128i aseman_color_select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// SSE2 has no 32bit mullo, products are made from the two even/odd 64bit multiplies
+static inline __m128i aseman_color_mullo(__m128i a, __m128i b)
+{
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+static inline __m128i aseman_color_mask(int method, __m128i r, __m128i g, __m128i b)
+{
+    if(method == AsemanImageColorAnalizor::Normal)
+    {
+        const __m128i sum = _mm_add_epi32(_mm_add_epi32(r, g), b);
+        return _mm_and_si128(_mm_cmpgt_epi32(sum, _mm_set1_epi32(209)),
+                             _mm_cmplt_epi32(sum, _mm_set1_epi32(543)));
+    }
+
+    __m128i max = aseman_color_select(_mm_cmpgt_epi32(r, g), r, g);
+    max = aseman_color_select(_mm_cmpgt_epi32(max, b), max, b);
+    __m128i min = aseman_color_select(_mm_cmplt_epi32(r, g), r, g);
+    min = aseman_color_select(_mm_cmplt_epi32(min, b), min, b);
+
+    const __m128i maxProduct = aseman_color_mullo(max, _mm_set1_epi32(54271));
+    const __m128i minProduct = aseman_color_mullo(min, _mm_set1_epi32(131070));
+    return _mm_and_si128(_mm_cmpgt_epi32(_mm_add_epi32(maxProduct, _mm_set1_epi32(1)), minProduct),
+                         _mm_cmpgt_epi32(_mm_add_epi32(max, min), _mm_set1_epi32(99)));
+}
+
+static void aseman_color_row(int method, const quint32 *line, int width, AsemanImageColorSums &sums)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    __m128i red = _mm_setzero_si128();
+    __m128i green = _mm_setzero_si128();
+    __m128i blue = _mm_setzero_si128();
+    __m128i count = _mm_setzero_si128();
+
+    // 32bit lanes can't overflow in a single row
+    int x = 0;
+    for(; x+4 <= width; x+=4)
+    {
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line+x));
+        const __m128i r = _mm_and_si128(_mm_srli_epi32(px, 16), byteMask);
+        const __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), byteMask);
+        const __m128i b = _mm_and_si128(px, byteMask);
+        const __m128i mask = aseman_color_mask(method, r, g, b);
+
+        red = _mm_add_epi32(red, _mm_and_si128(r, mask));
+        green = _mm_add_epi32(green, _mm_and_si128(g, mask));
+        blue = _mm_add_epi32(blue, _mm_and_si128(b, mask));
+        count = _mm_sub_epi32(count, mask);
+    }
+
+    sums.red += aseman_color_hsum(red);
+    sums.green += aseman_color_hsum(green);
+    sums.blue += aseman_color_hsum(blue);
+    sums.count += aseman_color_hsum(count);
+
+    aseman_color_row_scalar(method, line, x, width, sums);
+}
+
+#else
+static void aseman_color_row(int method, const quint32 *line, int width, AsemanImageColorSums &sums)
+{
+    aseman_color_row_scalar(method, line, 0, width, sums);
+}
+#endif
+
+static QImage aseman_color_argb_image(const QImage &image)
+{
+    // Both formats are 0xAARRGGBB words
+    if(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32)
+        return image;
+    return image.convertToFormat(QImage::Format_ARGB32);
+}
+
+void aseman_image_color_sums(const QImage &image, int method, AsemanImageColorSums &sums)
+{
+    if(image.isNull())
+        return;
+
+    // The alpha is ignored, like QColor(QRgb)
+    const QImage &img = aseman_color_argb_image(image);
+
+    const int width = img.width();
+    for(int y=0; y<img.height(); y++)
+        aseman_color_row(method, reinterpret_cast<const quint32*>(img.constScanLine(y)), width, sums);
+}
+
+
+class AsemanImageColorHistogram
+{
+public:
+    AsemanImageColorHistogram():
+        counts(PALETTE_SIDE*PALETTE_SIDE*PALETTE_SIDE),
+        red(counts.size()),
+        green(counts.size()),
+        blue(counts.size())
+    {}
+
+    static int index(int r, int g, int b) {
+        return (r << (2*PALETTE_BITS)) | (g << PALETTE_BITS) | b;
+    }
+
+    QVector<quint32> counts;
+    QVector<quint32> red;
+    QVector<quint32> green;
+    QVector<quint32> blue;
+};
+
+class AsemanImageColorBox
+{
+public:
+    AsemanImageColorBox(): count(0) {
+        for(int i=0; i<3; i++) {
+            lo[i] = 0;
+            hi[i] = PALETTE_SIDE-1;
+        }
+    }
+
+    int length(int axis) const { return hi[axis] - lo[axis]; }
+    int longestAxis() const {
+        int axis = 0;
+        for(int i=1; i<3; i++)
+            if(length(i) > length(axis))
+                axis = i;
+        return axis;
+    }
+
+    // Shrinks the box to its populated cells and counts them
+    void fit(const AsemanImageColorHistogram &hist) {
+        int min[3] = {PALETTE_SIDE, PALETTE_SIDE, PALETTE_SIDE};
+        int max[3] = {-1, -1, -1};
+        count = 0;
+        for(int r=lo[0]; r<=hi[0]; r++)
+            for(int g=lo[1]; g<=hi[1]; g++)
+                for(int b=lo[2]; b<=hi[2]; b++)
+                {
+                    const quint32 c = hist.counts[AsemanImageColorHistogram::index(r, g, b)];
+                    if(!c)
+                        continue;
+
+                    const int cell[3] = {r, g, b};
+                    for(int i=0; i<3; i++) {
+                        min[i] = qMin(min[i], cell[i]);
+                        max[i] = qMax(max[i], cell[i]);
+                    }
+                    count += c;
+                }
+
+        if(!count)
+            return;
+        for(int i=0; i<3; i++) {
+            lo[i] = min[i];
+            hi[i] = max[i];
+        }
+    }
+
+    QColor average(const AsemanImageColorHistogram &hist) const {
+        quint64 r = 0, g = 0, b = 0;
+        for(int i=lo[0]; i<=hi[0]; i++)
+            for(int j=lo[1]; j<=hi[1]; j++)
+                for(int k=lo[2]; k<=hi[2]; k++)
+                {
+                    const int idx = AsemanImageColorHistogram::index(i, j, k);
+                    r += hist.red[idx];
+                    g += hist.green[idx];
+                    b += hist.blue[idx];
+                }
+
+        return QColor(r/count, g/count, b/count);
+    }
+
+    int lo[3];
+    int hi[3];
+    quint64 count;
+};
+
+// Median cut over a 15bit histogram of a sampled image
+QVariantList aseman_image_color_palette(const QImage &image, int size)
+{
+    QVariantList res;
+    if(image.isNull() || size <= 0)
+        return res;
+
+    const QImage &img = aseman_color_argb_image(image);
+    int step = 1;
+    while((img.width()/step) * (img.height()/step) > PALETTE_SAMPLES)
+        step++;
+
+    AsemanImageColorHistogram hist;
+    const bool hasAlpha = img.hasAlphaChannel();
+    for(int y=0; y<img.height(); y+=step)
+    {
+        const quint32 *line = reinterpret_cast<const quint32*>(img.constScanLine(y));
+        for(int x=0; x<img.width(); x+=step)
+        {
+            const quint32 px = line[x];
+            if(hasAlpha && (px >> 24) < 128)
+                continue;
+
+            const int r = (px >> 16) & 0xff;
+            const int g = (px >> 8) & 0xff;
+            const int b = px & 0xff;
+            const int idx = AsemanImageColorHistogram::index(r >> (8-PALETTE_BITS), g >> (8-PALETTE_BITS), b >> (8-PALETTE_BITS));
+            hist.counts[idx]++;
+            hist.red[idx] += r;
+            hist.green[idx] += g;
+            hist.blue[idx] += b;
+        }
+    }
+
+    AsemanImageColorBox first;
+    first.fit(hist);
+    if(!first.count)
+        return res;
+
+    const quint64 total = first.count;
+    QList<AsemanImageColorBox> boxes;
+    boxes << first;
+    while(boxes.count() < size)
+    {
+        // The most populated box that still can be split
+        int target = -1;
+        for(int i=0; i<boxes.count(); i++)
+        {
+            const AsemanImageColorBox &box = boxes.at(i);
+            if(box.length(box.longestAxis()) == 0)
+                continue;
+            if(target == -1 || box.count > boxes.at(target).count)
+                target = i;
+        }
+        if(target == -1)
+            break;
+
+        const AsemanImageColorBox box = boxes.takeAt(target);
+        const int axis = box.longestAxis();
+
+        QVector<quint64> planes(PALETTE_SIDE);
+        for(int r=box.lo[0]; r<=box.hi[0]; r++)
+            for(int g=box.lo[1]; g<=box.hi[1]; g++)
+                for(int b=box.lo[2]; b<=box.hi[2]; b++)
+                {
+                    const int cell[3] = {r, g, b};
+                    planes[cell[axis]] += hist.counts[AsemanImageColorHistogram::index(r, g, b)];
+                }
+
+        int cut = box.lo[axis];
+        quint64 sum = planes[cut];
+        while(cut < box.hi[axis]-1 && sum < box.count/2)
+            sum += planes[++cut];
+
+        AsemanImageColorBox left = box;
+        AsemanImageColorBox right = box;
+        left.hi[axis] = cut;
+        right.lo[axis] = cut+1;
+        left.fit(hist);
+        right.fit(hist);
+        boxes << left << right;
+    }
+
+    std::sort(boxes.begin(), boxes.end(), [](const AsemanImageColorBox &a, const AsemanImageColorBox &b){
+        return a.count > b.count;
+    });
+
+    for(const AsemanImageColorBox &box: boxes)
+    {
+        QVariantMap swatch;
+        swatch["color"] = box.average(hist);
+        swatch["weight"] = static_cast<qreal>(box.count)/total;
+        res << swatch;
+    }
+
+    return res;
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANIMAGECOLORKERNEL_H
+#define ASEMANIMAGECOLORKERNEL_H
+
+#include <QImage>
+#include <QColor>
+#include <QVariantList>
+
+class AsemanImageColorSums
+{
+public:
+    AsemanImageColorSums(): red(0), green(0), blue(0), count(0) {}
+    quint64 red;
+    quint64 green;
+    quint64 blue;
+    quint64 count;
+
+    QColor average() const {
+        if(!count)
+            return QColor();
+        return QColor(red/count, green/count, blue/count);
+    }
+};
+
+void aseman_image_color_sums(const QImage &image, int method, AsemanImageColorSums &sums);
+QVariantList aseman_image_color_palette(const QImage &image, int size);
+
+#endif // ASEMANIMAGECOLORKERNEL_H
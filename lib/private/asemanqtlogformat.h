@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANQTLOGFORMAT_H
+#define ASEMANQTLOGFORMAT_H
+
+/*
+ * Binary log file of AsemanQtLogger:
+ *   "ASLG" | version (quint32 LE) | records ...
+ * Each record:
+ *   type (uchar) | payload size (quint32 LE) | payload
+ * String record payload:
+ *   id (quint32 LE) | utf8 text
+ * Event record payload:
+ *   msecs since epoch (qint64 LE) | level (uchar) | thread id (quint64 LE) |
+ *   category id | file id | line | function id (quint32 LE each) | utf8 message
+ * A string is defined once per file, before the first event using it.
+ * All numbers are little endian.
+ */
+
+#define ASEMAN_LOG_MAGIC "ASLG"
+#define ASEMAN_LOG_MAGIC_SIZE 4
+#define ASEMAN_LOG_VERSION 1
+#define ASEMAN_LOG_HEADER_SIZE 8
+#define ASEMAN_LOG_RECORD_HEAD 5
+#define ASEMAN_LOG_STRING_RECORD 1
+#define ASEMAN_LOG_EVENT_RECORD 2
+#define ASEMAN_LOG_EVENT_FIXED_SIZE 33
+
+#endif // ASEMANQTLOGFORMAT_H